@@ -0,0 +1,126 @@
+#ifndef BVH_H
+#define BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+
+class bvh_node : public hittable {
+    // A binary bounding volume hierarchy. Each node splits its objects in half at the median of
+    // their box centers, along the axis where the centers spread the widest. The later books
+    // build theirs with the surface area heuristic instead, and flatten them for traversal.
+    //
+    // The box and center of every object are computed once up front, and each split reorders
+    // that array in place, so the build makes no virtual calls after the first pass.
+    public:
+        bvh_node(const hittable_list& list);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override {
+            output_box = box;
+            return true;
+        }
+
+    public:
+        shared_ptr<hittable> left;
+        shared_ptr<hittable> right;
+        aabb box;
+
+    private:
+        struct primitive {
+            aabb box;
+            point3 center;
+            size_t index;
+        };
+
+        // Builds the node over prims[start, end), which it reorders.
+        bvh_node(
+            std::vector<primitive>& prims, size_t start, size_t end,
+            const std::vector<shared_ptr<hittable>>& objects) {
+            build(prims, start, end, objects);
+        }
+
+        void build(
+            std::vector<primitive>& prims, size_t start, size_t end,
+            const std::vector<shared_ptr<hittable>>& objects);
+
+        static shared_ptr<hittable> make_child(
+            std::vector<primitive>& prims, size_t start, size_t end,
+            const std::vector<shared_ptr<hittable>>& objects) {
+            // A single object needs no node of its own.
+            if (end - start == 1)
+                return objects[prims[start].index];
+            return shared_ptr<bvh_node>(new bvh_node(prims, start, end, objects));
+        }
+};
+
+
+bvh_node::bvh_node(const hittable_list& list) {
+    std::vector<primitive> prims(list.objects.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        if (!list.objects[i]->bounding_box(prims[i].box))
+            std::cerr << "No bounding box in bvh_node constructor.\n";
+        prims[i].center = 0.5 * (prims[i].box.min() + prims[i].box.max());
+        prims[i].index = i;
+    }
+
+    build(prims, 0, prims.size(), list.objects);
+}
+
+
+void bvh_node::build(
+    std::vector<primitive>& prims, size_t start, size_t end,
+    const std::vector<shared_ptr<hittable>>& objects
+) {
+    box = prims[start].box;
+    aabb centers(prims[start].center, prims[start].center);
+    for (size_t i = start+1; i < end; i++) {
+        box = surrounding_box(box, prims[i].box);
+        centers = surrounding_box(centers, aabb(prims[i].center, prims[i].center));
+    }
+    auto axis = centers.longest_axis();
+
+    if (end - start == 1) {
+        left = right = objects[prims[start].index];
+    } else {
+        auto mid = start + (end - start) / 2;
+        std::nth_element(
+            prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+            [=](const primitive& a, const primitive& b) {
+                return a.center[axis] < b.center[axis];
+            });
+
+        left = make_child(prims, start, mid, objects);
+        right = make_child(prims, mid, end, objects);
+    }
+}
+
+
+bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    if (!box.hit(r, t_min, t_max))
+        return false;
+
+    bool hit_left = left->hit(r, t_min, t_max, rec);
+    bool hit_right = right != left && right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+
+    return hit_left || hit_right;
+}
+
+
+#endif
@@ -13,13 +13,15 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+
 class material;
 
 
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
+    const material* mat_ptr;  // Not owned: the scene keeps its materials alive
     double t;
     bool front_face;
 
@@ -33,6 +35,7 @@ struct hit_record {
 class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(aabb& output_box) const = 0;
 };
 
 
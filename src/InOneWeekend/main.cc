@@ -15,29 +15,43 @@
 #include "color.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "render.h"
+#include "scene_compiler.h"
 #include "sphere.h"
 
 #include <iostream>
 
 
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
+color ray_color(ray r, const hittable& world, int max_depth) {
+    // Follow the path one bounce at a time, carrying the product of the attenuations so far.
+    color throughput(1,1,1);
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
+    for (int bounce = 1; bounce <= max_depth; bounce++) {
+        // Each bounce draws its random numbers from its own dimensions of the sample stream.
+        set_sample_bounce(bounce);
+        thread_rays_traced()++;
+
+        hit_record rec;
+        if (!world.hit(r, 0.001, infinity, rec)) {
+            vec3 unit_direction = unit_vector(r.direction());
+            auto t = 0.5*(unit_direction.y() + 1.0);
+            return throughput * ((1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0));
+        }
 
-    if (world.hit(r, 0.001, infinity, rec)) {
         ray scattered;
         color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth-1);
-        return color(0,0,0);
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+            return color(0,0,0);
+
+        throughput = throughput * attenuation;
+        if (!survives_russian_roulette(throughput, bounce))
+            return color(0,0,0);
+
+        r = scattered;
     }
 
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5*(unit_direction.y() + 1.0);
-    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    return color(0,0,0);
 }
 
 
@@ -88,7 +102,8 @@ hittable_list random_scene() {
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    auto options = parse_render_options(argc, argv);
 
     // Image
 
@@ -100,7 +115,7 @@ int main() {
 
     // World
 
-    auto world = random_scene();
+    auto world = compile_scene(random_scene());
 
     // Camera
 
@@ -114,21 +129,15 @@ int main() {
 
     // Render
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0,0,0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
-        }
-    }
+    tile_renderer renderer(image_width, image_height, samples_per_pixel, options);
+
+    renderer.render([&](double u, double v) {
+        ray r = cam.get_ray(u, v);
+        return ray_color(r, world, max_depth);
+    });
+
+    if (!renderer.write_image())
+        return 1;
 
     std::cerr << "\nDone.\n";
 }
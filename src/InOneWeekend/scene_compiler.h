@@ -0,0 +1,49 @@
+#ifndef SCENE_COMPILER_H
+#define SCENE_COMPILER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <typeinfo>
+
+
+// Scene compilation: rewrites a scene into an equivalent one that is quicker to trace. Nested
+// lists are merged into the list that holds them, and a list of more objects than are worth
+// testing one by one is replaced by a BVH over them. The objects are shared with the original
+// scene, not copied, so it must not be changed afterwards.
+
+const size_t compiled_list_limit = 4;  // Longest list left without a BVH
+
+
+void gather_compiled(const hittable_list& list, hittable_list& out) {
+    for (const auto& object : list.objects) {
+        if (typeid(*object) == typeid(hittable_list))
+            gather_compiled(static_cast<const hittable_list&>(*object), out);
+        else
+            out.add(object);
+    }
+}
+
+
+hittable_list compile_scene(const hittable_list& scene) {
+    hittable_list compiled;
+    gather_compiled(scene, compiled);
+
+    if (compiled.objects.size() <= compiled_list_limit)
+        return compiled;
+    return hittable_list(make_shared<bvh_node>(compiled));
+}
+
+
+#endif
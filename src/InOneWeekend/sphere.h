@@ -26,6 +26,13 @@ class sphere : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool bounding_box(aabb& output_box) const override {
+            output_box = aabb(
+                center - vec3(radius, radius, radius),
+                center + vec3(radius, radius, radius));
+            return true;
+        }
+
     public:
         point3 center;
         double radius;
@@ -55,7 +62,7 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mat_ptr;
+    rec.mat_ptr = mat_ptr.get();
 
     return true;
 }
@@ -13,108 +13,122 @@
 
 #include "rtweekend.h"
 
+#include "bvh_build.h"
 #include "hittable.h"
 #include "hittable_list.h"
 
 #include <algorithm>
 
 
+struct bvh_stats {
+    int node_count = 0;              // Number of tree nodes
+    int max_depth = 0;               // Deepest node, with the root at depth 1
+    double box_tests = 0;            // Expected box tests for a ray that hits the root box
+    double primitive_tests = 0;      // Expected primitive tests for a ray that hits the root box
+
+    double expected_cost() const { return box_tests + primitive_tests; }
+};
+
+
+struct traversal_stats {
+    // Work counted while tracing rays, for comparing BVH layouts.
+    long rays = 0;
+    long nodes_visited = 0;    // Nodes popped and processed
+    long box_tests = 0;        // Individual boxes tested
+    long primitive_tests = 0;  // Primitive hit_closest() calls
+};
+
+
 class bvh_node : public hittable  {
     public:
         bvh_node();
 
-        bvh_node(const hittable_list& list, double time0, double time1)
-            : bvh_node(list.objects, 0, list.objects.size(), time0, time1)
+        bvh_node(
+            const hittable_list& list, double time0, double time1,
+            bvh_split split = bvh_split::sah
+        ) : bvh_node(list.objects, 0, list.objects.size(), time0, time1, split)
         {}
 
         bvh_node(
             const std::vector<shared_ptr<hittable>>& src_objects,
-            size_t start, size_t end, double time0, double time1);
+            size_t start, size_t end, double time0, double time1,
+            bvh_split split = bvh_split::sah
+        ) : bvh_node(bvh_builder(src_objects, start, end, time0, time1, split, 2), 0, src_objects)
+        {}
+
+        // Builds the subtree rooted at the given node of a finished build.
+        bvh_node(
+            const bvh_builder& builder, size_t index,
+            const std::vector<shared_ptr<hittable>>& objects);
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return box.hit(r, t_min, t_max)
+                && (left->occluded(r, t_min, t_max) || right->occluded(r, t_min, t_max));
+        }
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
+        // Report the size and expected traversal cost of the tree. Costs are weighted by the
+        // surface area heuristic: the chance that a ray hitting the root box also hits a node's
+        // box is the ratio of their surface areas.
+        bvh_stats stats() const;
+
     public:
         shared_ptr<hittable> left;
         shared_ptr<hittable> right;
         aabb box;
-};
-
-
-inline bool box_compare(const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis) {
-    aabb box_a;
-    aabb box_b;
-
-    if (!a->bounding_box(0,0, box_a) || !b->bounding_box(0,0, box_b))
-        std::cerr << "No bounding box in bvh_node constructor.\n";
-
-    return box_a.min().e[axis] < box_b.min().e[axis];
-}
 
+    private:
+        static shared_ptr<hittable> make_child(
+            const bvh_builder& builder, size_t index,
+            const std::vector<shared_ptr<hittable>>& objects);
 
-bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 0);
-}
-
-bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 1);
-}
-
-bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
-    return box_compare(a, b, 2);
-}
+        void accumulate_stats(bvh_stats& stats, double root_area, int depth) const;
+};
 
 
 bvh_node::bvh_node(
-    const std::vector<shared_ptr<hittable>>& src_objects,
-    size_t start, size_t end, double time0, double time1
+    const bvh_builder& builder, size_t index, const std::vector<shared_ptr<hittable>>& objects
 ) {
-    auto objects = src_objects; // Create a modifiable array of the source scene objects
-
-    int axis = random_int(0,2);
-    auto comparator = (axis == 0) ? box_x_compare
-                    : (axis == 1) ? box_y_compare
-                                  : box_z_compare;
-
-    size_t object_span = end - start;
-
-    if (object_span == 1) {
-        left = right = objects[start];
-    } else if (object_span == 2) {
-        if (comparator(objects[start], objects[start+1])) {
-            left = objects[start];
-            right = objects[start+1];
-        } else {
-            left = objects[start+1];
-            right = objects[start];
-        }
-    } else {
-        std::sort(objects.begin() + start, objects.begin() + end, comparator);
+    const auto& node = builder.nodes[index];
+    box = node.box;
 
-        auto mid = start + object_span/2;
-        left = make_shared<bvh_node>(objects, start, mid, time0, time1);
-        right = make_shared<bvh_node>(objects, mid, end, time0, time1);
+    if (node.count == 0) {
+        left = make_child(builder, index + 1, objects);
+        right = make_child(builder, node.offset, objects);
+    } else {
+        // Leaves hold at most two objects, which become the children directly.
+        left = objects[builder.order[node.offset]];
+        right = objects[builder.order[node.offset + node.count - 1]];
     }
+}
 
-    aabb box_left, box_right;
-
-    if (  !left->bounding_box (time0, time1, box_left)
-       || !right->bounding_box(time0, time1, box_right)
-    )
-        std::cerr << "No bounding box in bvh_node constructor.\n";
 
-    box = surrounding_box(box_left, box_right);
+shared_ptr<hittable> bvh_node::make_child(
+    const bvh_builder& builder, size_t index, const std::vector<shared_ptr<hittable>>& objects
+) {
+    // A single-object leaf needs no node of its own.
+    const auto& node = builder.nodes[index];
+    if (node.count == 1)
+        return objects[builder.order[node.offset]];
+    return make_shared<bvh_node>(builder, index, objects);
 }
 
 
-bool bvh_node::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool bvh_node::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
     if (!box.hit(r, t_min, t_max))
         return false;
 
-    bool hit_left = left->hit(r, t_min, t_max, rec);
-    bool hit_right = right->hit(r, t_min, hit_left ? rec.t : t_max, rec);
+    bool hit_left = left->hit_closest(r, t_min, t_max, query);
+    bool hit_right = right->hit_closest(r, t_min, hit_left ? query.t : t_max, query);
 
     return hit_left || hit_right;
 }
@@ -126,4 +140,30 @@ bool bvh_node::bounding_box(double time0, double time1, aabb& output_box) const
 }
 
 
+bvh_stats bvh_node::stats() const {
+    bvh_stats stats;
+    accumulate_stats(stats, box.area(), 1);
+    return stats;
+}
+
+
+void bvh_node::accumulate_stats(bvh_stats& stats, double root_area, int depth) const {
+    stats.node_count++;
+    stats.max_depth = std::max(stats.max_depth, depth);
+
+    // A ray reaching this node tests its box. If the box is hit, each child is either another
+    // node (counted by its own recursion) or a primitive that is tested directly.
+    auto p = box.area() / root_area;
+    stats.box_tests += p;
+
+    for (const auto& child : {left, right}) {
+        auto node = std::dynamic_pointer_cast<bvh_node>(child);
+        if (node)
+            node->accumulate_stats(stats, root_area, depth+1);
+        else
+            stats.primitive_tests += p;
+    }
+}
+
+
 #endif
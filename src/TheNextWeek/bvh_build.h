@@ -0,0 +1,318 @@
+#ifndef BVH_BUILD_H
+#define BVH_BUILD_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+enum class bvh_split {
+    random_axis,  // Split at the median centroid along a random axis
+    sah           // Binned surface area heuristic along the longest centroid axis
+};
+
+
+inline aabb bounding_box_of(const shared_ptr<hittable>& object, double time0, double time1) {
+    aabb box;
+    if (!object->bounding_box(time0, time1, box))
+        std::cerr << "No bounding box in bvh_node constructor.\n";
+    return box;
+}
+
+
+inline point3 centroid(const aabb& box) {
+    return 0.5 * (box.min() + box.max());
+}
+
+
+struct bvh_build_node {
+    aabb box;
+    size_t offset;  // Interior: index of the second child. Leaf: first slot in the leaf order.
+    size_t count;   // Number of primitives in a leaf, zero for interior nodes
+    int axis;       // Split axis of an interior node
+};
+
+
+class bvh_builder {
+    // Builds a binary BVH over a range of objects into a flat, depth-first array of nodes: the
+    // first child of an interior node immediately follows it. The box and centroid of every
+    // object are computed once up front, and each split partitions that array in place, so the
+    // build makes no per-node allocations and no virtual calls after the first pass. The upper
+    // levels of the tree are built in parallel.
+    //
+    // The surface area heuristic weighs the cost of testing a primitive against the cost of
+    // traversing a node. A primitive_cost below one suits leaves that test their primitives
+    // together, such as sphere_set, and makes larger leaves.
+    public:
+        bvh_builder(
+            const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+            double time0, double time1, bvh_split split, int max_leaf_primitives,
+            double primitive_cost = 1);
+
+    public:
+        std::vector<bvh_build_node> nodes;  // Node 0 is the root
+        std::vector<size_t> order;          // Object index for each leaf slot
+
+    private:
+        struct primitive {
+            aabb box;
+            point3 centroid;
+            size_t index;
+        };
+
+        static const int max_depth = 32;     // Beyond this, split at the median to bound depth
+        static const size_t parallel_threshold = 4096;  // Smallest range built as its own task
+
+        std::vector<primitive> prims;
+        bvh_split split;
+        int max_leaf;
+        double primitive_cost;
+        int parallel_depth;
+
+        bool split_range(size_t start, size_t end, int depth, bvh_build_node& node, size_t& mid);
+
+        size_t build(std::vector<bvh_build_node>& out, size_t start, size_t end, int depth);
+
+        size_t build_parallel(
+            std::vector<bvh_build_node>& out, size_t start, size_t end, int depth);
+};
+
+
+bvh_builder::bvh_builder(
+    const std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+    double time0, double time1, bvh_split split_method, int max_leaf_primitives,
+    double leaf_primitive_cost
+) : split(split_method), max_leaf(max_leaf_primitives), primitive_cost(leaf_primitive_cost) {
+    auto thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    // Spawn tasks down to the depth where there are a few subtrees per thread.
+    parallel_depth = 2;
+    while ((1u << parallel_depth) < thread_count) parallel_depth++;
+
+    // Gather primitive boxes and centroids, splitting the virtual calls across threads.
+    prims.resize(end - start);
+
+    auto gather = [&](size_t begin, size_t finish) {
+        for (size_t i = begin; i < finish; i++) {
+            prims[i].box = bounding_box_of(objects[start + i], time0, time1);
+            prims[i].centroid = centroid(prims[i].box);
+            prims[i].index = start + i;
+        }
+    };
+
+    if (prims.size() < parallel_threshold || thread_count == 1) {
+        gather(0, prims.size());
+    } else {
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < thread_count; t++)
+            threads.emplace_back(gather, prims.size() * t / thread_count,
+                                         prims.size() * (t+1) / thread_count);
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    if (!prims.empty()) {
+        nodes.reserve(2 * prims.size());
+        build_parallel(nodes, 0, prims.size(), 1);
+    }
+
+    order.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++)
+        order[i] = prims[i].index;
+
+    prims.clear();
+    prims.shrink_to_fit();
+}
+
+
+bool bvh_builder::split_range(
+    size_t start, size_t end, int depth, bvh_build_node& node, size_t& mid
+) {
+    // Fills in the bounds of the node for prims[start,end). Returns false if the range should
+    // become a leaf, and otherwise partitions the range and sets mid to the split point.
+
+    aabb centroid_bounds(prims[start].centroid, prims[start].centroid);
+    node.box = prims[start].box;
+    for (size_t i = start+1; i < end; i++) {
+        node.box = surrounding_box(node.box, prims[i].box);
+        centroid_bounds = surrounding_box(
+            centroid_bounds, aabb(prims[i].centroid, prims[i].centroid));
+    }
+
+    auto span = end - start;
+    if (span == 1)
+        return false;
+
+    // The random axis is a hash of the node's object range rather than a draw from the
+    // renderer's random numbers, so building a BVH does not disturb the rest of the scene.
+    int axis = (split == bvh_split::random_axis)
+        ? static_cast<int>(hash64((static_cast<uint64_t>(start) << 32) ^ end) % 3)
+        : centroid_bounds.longest_axis();
+
+    auto lo = centroid_bounds.min()[axis];
+    auto extent = centroid_bounds.max()[axis] - lo;
+    auto fits_leaf = span <= static_cast<size_t>(max_leaf);
+
+    node.axis = axis;
+    mid = start;
+
+    if (extent <= 0 && fits_leaf)
+        return false;
+
+    if (split == bvh_split::random_axis && span <= 2)
+        return false;
+
+    if (split == bvh_split::sah && extent > 0 && depth < max_depth) {
+        const int bin_count = 12;
+        const double traversal_cost = 0.125;  // Relative to one primitive test at full cost
+
+        auto bin_of = [=](const primitive& p) -> int {
+            auto b = static_cast<int>(bin_count * (p.centroid[axis] - lo) / extent);
+            return b < bin_count ? b : bin_count-1;
+        };
+
+        aabb bin_box[bin_count];
+        int bin_objects[bin_count] = {};
+        for (size_t i = start; i < end; i++) {
+            auto b = bin_of(prims[i]);
+            bin_box[b] = bin_objects[b] ? surrounding_box(bin_box[b], prims[i].box)
+                                        : prims[i].box;
+            bin_objects[b]++;
+        }
+
+        // Sweep from the right to find the area and count of everything right of each split
+        // plane, then sweep from the left to evaluate the cost of each plane.
+        double right_area[bin_count];
+        int right_objects[bin_count];
+        aabb accum;
+        int count = 0;
+        for (int b = bin_count-1; b > 0; b--) {
+            if (bin_objects[b])
+                accum = count ? surrounding_box(accum, bin_box[b]) : bin_box[b];
+            count += bin_objects[b];
+            right_area[b] = count ? accum.area() : 0;
+            right_objects[b] = count;
+        }
+
+        auto best_cost = infinity;
+        int best_split = 0;
+        count = 0;
+        for (int b = 1; b < bin_count; b++) {
+            if (bin_objects[b-1])
+                accum = count ? surrounding_box(accum, bin_box[b-1]) : bin_box[b-1];
+            count += bin_objects[b-1];
+            if (count == 0 || right_objects[b] == 0)
+                continue;
+
+            auto cost = count * accum.area() + right_objects[b] * right_area[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        // Stop with a leaf when testing every primitive is cheaper than the best split.
+        auto leaf_cost = primitive_cost * span;
+        auto split_cost = traversal_cost + primitive_cost * best_cost / node.box.area();
+        if (fits_leaf && leaf_cost <= split_cost)
+            return false;
+
+        if (best_split > 0) {
+            auto middle = std::partition(prims.begin() + start, prims.begin() + end,
+                [&](const primitive& p) { return bin_of(p) < best_split; });
+            mid = static_cast<size_t>(middle - prims.begin());
+        }
+    }
+
+    if (mid == start || mid == end) {
+        mid = start + span/2;
+        std::nth_element(prims.begin() + start, prims.begin() + mid, prims.begin() + end,
+            [=](const primitive& a, const primitive& b) {
+                return a.centroid[axis] < b.centroid[axis];
+            });
+    }
+
+    return true;
+}
+
+
+size_t bvh_builder::build(std::vector<bvh_build_node>& out, size_t start, size_t end, int depth) {
+    // Appends the subtree for prims[start,end) to out, and returns the index of its root.
+    auto index = out.size();
+    out.push_back(bvh_build_node());
+
+    size_t mid;
+    if (!split_range(start, end, depth, out[index], mid)) {
+        out[index].offset = start;
+        out[index].count = end - start;
+        return index;
+    }
+
+    // Appending may reallocate out, so only index into it after the children are built.
+    build(out, start, mid, depth+1);
+    auto second = build(out, mid, end, depth+1);
+    out[index].offset = second;
+    out[index].count = 0;
+    return index;
+}
+
+
+size_t bvh_builder::build_parallel(
+    std::vector<bvh_build_node>& out, size_t start, size_t end, int depth
+) {
+    if (depth > parallel_depth || end - start < parallel_threshold)
+        return build(out, start, end, depth);
+
+    auto index = out.size();
+    out.push_back(bvh_build_node());
+
+    size_t mid;
+    if (!split_range(start, end, depth, out[index], mid)) {
+        out[index].offset = start;
+        out[index].count = end - start;
+        return index;
+    }
+
+    // Build the two subtrees concurrently into their own arrays, then append them. The child
+    // ranges of prims are disjoint, so the tasks never touch the same primitives.
+    std::vector<bvh_build_node> left_nodes, right_nodes;
+
+    auto left_task = std::async(std::launch::async, [&] {
+        build_parallel(left_nodes, start, mid, depth+1);
+    });
+    build_parallel(right_nodes, mid, end, depth+1);
+    left_task.get();
+
+    auto append = [&](const std::vector<bvh_build_node>& subtree) -> size_t {
+        auto base = out.size();
+        for (auto node : subtree) {
+            if (node.count == 0)
+                node.offset += base;
+            out.push_back(node);
+        }
+        return base;
+    };
+
+    append(left_nodes);
+    auto second = append(right_nodes);
+    out[index].offset = second;
+    out[index].count = 0;
+    return index;
+}
+
+
+#endif
@@ -0,0 +1,362 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "aarect.h"
+#include "box.h"
+#include "bvh.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+#include "sphere_set.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <typeinfo>
+#include <vector>
+
+
+enum class primitive_type : uint32_t {
+    sphere,
+    moving_sphere,
+    xy_rect,
+    xz_rect,
+    yz_rect,
+    box,
+    sphere_set,
+    other,  // Any other hittable, such as a transform or a medium, called through its vtable
+    count
+};
+
+
+class compiled_scene : public hittable {
+    // A scene compiled from a hittable_list into a form built for intersection. The lists and
+    // BVHs of the scene are flattened, and its primitives are copied into one array per type.
+    // A single binary BVH over all of them holds, in each leaf, a run of tagged references: the
+    // type in the top bits and the index into that type's array in the rest. The BVH has the
+    // nodes and traversal of a wide_bvh<4>, and tests a reference with a switch on its type and
+    // a direct call to that type's own intersection code, which the compiler can inline, so
+    // there are no virtual calls and no pointers to follow to reach a primitive's data. Hits are
+    // the same as the scene's own, found by the same arithmetic.
+    //
+    // Only the types listed in primitive_type are compiled; anything else, such as translate,
+    // rotate_y or constant_medium, is kept whole, subtree and all, as an "other" primitive.
+    public:
+        compiled_scene(const hittable_list& list, double time0, double time1);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            hit_query query;
+            uint32_t ref = 0;
+            if (!traverse<false>(r, t_min, t_max, query, ref))
+                return false;
+            compute_primitive(ref, r, t_min, query, rec);
+            return true;
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override {
+            uint32_t ref;
+            return traverse<false>(r, t_min, t_max, query, ref);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            hit_query query;
+            uint32_t ref;
+            return traverse<true>(r, t_min, t_max, query, ref);
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = box;
+            return true;
+        }
+
+        size_t primitive_count(primitive_type type) const;
+        size_t node_count() const { return count; }
+
+    public:
+        std::vector<sphere> spheres;
+        std::vector<moving_sphere> moving_spheres;
+        std::vector<xy_rect> xy_rects;
+        std::vector<xz_rect> xz_rects;
+        std::vector<yz_rect> yz_rects;
+        std::vector<::box> boxes;
+        std::vector<sphere_set> sphere_sets;
+        std::vector<shared_ptr<hittable>> others;
+        aabb box;
+
+    private:
+        static const int type_shift = 28;
+        static const uint32_t index_mask = (1u << type_shift) - 1;
+        static const int width = 4;
+        static const int max_leaf_primitives = 4;
+
+        std::unique_ptr<unsigned char[]> storage;
+        wide_bvh_node<width>* nodes;  // Cache-line aligned view of storage
+        size_t count;
+        std::vector<uint32_t> refs;   // Tagged primitive references, in leaf order
+
+        static void flatten(
+            const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& out);
+
+        uint32_t add_primitive(const shared_ptr<hittable>& object);
+
+        bool hit_primitive(
+            uint32_t ref, const ray& r, double t_min, double t_max, hit_query& query) const;
+        bool primitive_occluded(uint32_t ref, const ray& r, double t_min, double t_max) const;
+        void compute_primitive(
+            uint32_t ref, const ray& r, double t_min, const hit_query& query,
+            hit_record& rec) const;
+
+        // Finds the closest hit and the reference of its primitive, or with AnyHit, whether
+        // there is any hit at all.
+        template <bool AnyHit>
+        bool traverse(
+            const ray& r, double t_min, double t_max, hit_query& query, uint32_t& hit_ref
+        ) const {
+            return wide_bvh<width>::traverse_nodes<false, AnyHit>(
+                nodes, r, t_min, t_max,
+                [&](uint32_t i, double t_limit, double& t_hit) -> bool {
+                    auto ref = refs[i];
+                    if (AnyHit)
+                        return primitive_occluded(ref, r, t_min, t_limit);
+                    if (!hit_primitive(ref, r, t_min, t_limit, query))
+                        return false;
+                    t_hit = query.t;
+                    hit_ref = ref;
+                    return true;
+                },
+                nullptr);
+        }
+};
+
+
+compiled_scene::compiled_scene(const hittable_list& list, double time0, double time1)
+  : nodes(nullptr), count(0) {
+    std::vector<shared_ptr<hittable>> primitives;
+    for (const auto& object : list.objects)
+        flatten(object, primitives);
+
+    bvh_builder builder(
+        primitives, 0, primitives.size(), time0, time1, bvh_split::sah, max_leaf_primitives);
+
+    refs.reserve(builder.order.size());
+    for (auto index : builder.order)
+        refs.push_back(add_primitive(primitives[index]));
+
+    std::vector<wide_bvh_node<width>> built;
+    if (builder.nodes.empty()) {
+        built.push_back(wide_bvh_node<width>());
+        built[0].child_mask = 0;
+    } else {
+        wide_bvh<width>::collapse(builder, 0, built);
+    }
+
+    count = built.size();
+    void* aligned_start;
+    size_t space = count * sizeof(wide_bvh_node<width>) + 64;
+    storage.reset(new unsigned char[space]);
+    aligned_start = storage.get();
+    nodes = static_cast<wide_bvh_node<width>*>(
+        std::align(64, count * sizeof(wide_bvh_node<width>), aligned_start, space));
+    std::copy(built.begin(), built.end(), nodes);
+
+    box = builder.nodes.empty() ? aabb() : builder.nodes[0].box;
+}
+
+
+void compiled_scene::flatten(
+    const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& out
+) {
+    // Lists and BVHs only group their objects, so their contents go into the one BVH directly.
+    const auto& type = typeid(*object);
+
+    if (type == typeid(hittable_list)) {
+        for (const auto& child : static_cast<const hittable_list&>(*object).objects)
+            flatten(child, out);
+    } else if (type == typeid(bvh_node)) {
+        const auto& node = static_cast<const bvh_node&>(*object);
+        flatten(node.left, out);
+        if (node.right != node.left)
+            flatten(node.right, out);
+    } else if (type == typeid(linear_bvh)) {
+        for (const auto& child : static_cast<const linear_bvh&>(*object).objects)
+            flatten(child, out);
+    } else if (type == typeid(wide_bvh<4>)) {
+        for (const auto& child : static_cast<const wide_bvh<4>&>(*object).objects)
+            flatten(child, out);
+    } else if (type == typeid(wide_bvh<8>)) {
+        for (const auto& child : static_cast<const wide_bvh<8>&>(*object).objects)
+            flatten(child, out);
+    } else {
+        out.push_back(object);
+    }
+}
+
+
+uint32_t compiled_scene::add_primitive(const shared_ptr<hittable>& object) {
+    // Copies the primitive into the array for its exact type; a subclass is not that type.
+    const auto& type = typeid(*object);
+    primitive_type tag;
+    size_t index;
+
+    if (type == typeid(sphere)) {
+        tag = primitive_type::sphere;
+        index = spheres.size();
+        spheres.push_back(static_cast<const sphere&>(*object));
+    } else if (type == typeid(moving_sphere)) {
+        tag = primitive_type::moving_sphere;
+        index = moving_spheres.size();
+        moving_spheres.push_back(static_cast<const moving_sphere&>(*object));
+    } else if (type == typeid(xy_rect)) {
+        tag = primitive_type::xy_rect;
+        index = xy_rects.size();
+        xy_rects.push_back(static_cast<const xy_rect&>(*object));
+    } else if (type == typeid(xz_rect)) {
+        tag = primitive_type::xz_rect;
+        index = xz_rects.size();
+        xz_rects.push_back(static_cast<const xz_rect&>(*object));
+    } else if (type == typeid(yz_rect)) {
+        tag = primitive_type::yz_rect;
+        index = yz_rects.size();
+        yz_rects.push_back(static_cast<const yz_rect&>(*object));
+    } else if (type == typeid(::box)) {
+        tag = primitive_type::box;
+        index = boxes.size();
+        boxes.push_back(static_cast<const ::box&>(*object));
+    } else if (type == typeid(sphere_set)) {
+        tag = primitive_type::sphere_set;
+        index = sphere_sets.size();
+        sphere_sets.push_back(static_cast<const sphere_set&>(*object));
+    } else {
+        tag = primitive_type::other;
+        index = others.size();
+        others.push_back(object);
+    }
+
+    if (index > index_mask)
+        std::cerr << "Too many primitives of one type in compiled_scene.\n";
+
+    return (static_cast<uint32_t>(tag) << type_shift) | static_cast<uint32_t>(index);
+}
+
+
+size_t compiled_scene::primitive_count(primitive_type type) const {
+    switch (type) {
+        case primitive_type::sphere:        return spheres.size();
+        case primitive_type::moving_sphere: return moving_spheres.size();
+        case primitive_type::xy_rect:       return xy_rects.size();
+        case primitive_type::xz_rect:       return xz_rects.size();
+        case primitive_type::yz_rect:       return yz_rects.size();
+        case primitive_type::box:           return boxes.size();
+        case primitive_type::sphere_set:    return sphere_sets.size();
+        case primitive_type::other:         return others.size();
+        default:                            return 0;
+    }
+}
+
+
+// The calls below name the class of each member function, so that they bind statically to that
+// type's own code instead of going through the vtable.
+
+bool compiled_scene::hit_primitive(
+    uint32_t ref, const ray& r, double t_min, double t_max, hit_query& query
+) const {
+    auto i = ref & index_mask;
+    switch (static_cast<primitive_type>(ref >> type_shift)) {
+        case primitive_type::sphere:
+            return spheres[i].sphere::hit_closest(r, t_min, t_max, query);
+        case primitive_type::moving_sphere:
+            return moving_spheres[i].moving_sphere::hit_closest(r, t_min, t_max, query);
+        case primitive_type::xy_rect:
+            return xy_rects[i].xy_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::xz_rect:
+            return xz_rects[i].xz_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::yz_rect:
+            return yz_rects[i].yz_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::box:
+            return boxes[i].::box::hit_closest(r, t_min, t_max, query);
+        case primitive_type::sphere_set:
+            return sphere_sets[i].sphere_set::hit_closest(r, t_min, t_max, query);
+        default:
+            return others[i]->hit_closest(r, t_min, t_max, query);
+    }
+}
+
+
+bool compiled_scene::primitive_occluded(
+    uint32_t ref, const ray& r, double t_min, double t_max
+) const {
+    // The rectangles have no occluded() of their own; their hit_closest() is as cheap.
+    auto i = ref & index_mask;
+    hit_query query;
+    switch (static_cast<primitive_type>(ref >> type_shift)) {
+        case primitive_type::sphere:
+            return spheres[i].sphere::occluded(r, t_min, t_max);
+        case primitive_type::moving_sphere:
+            return moving_spheres[i].moving_sphere::occluded(r, t_min, t_max);
+        case primitive_type::xy_rect:
+            return xy_rects[i].xy_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::xz_rect:
+            return xz_rects[i].xz_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::yz_rect:
+            return yz_rects[i].yz_rect::hit_closest(r, t_min, t_max, query);
+        case primitive_type::box:
+            return boxes[i].::box::occluded(r, t_min, t_max);
+        case primitive_type::sphere_set:
+            return sphere_sets[i].sphere_set::occluded(r, t_min, t_max);
+        default:
+            return others[i]->occluded(r, t_min, t_max);
+    }
+}
+
+
+void compiled_scene::compute_primitive(
+    uint32_t ref, const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto i = ref & index_mask;
+    switch (static_cast<primitive_type>(ref >> type_shift)) {
+        case primitive_type::sphere:
+            spheres[i].sphere::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::moving_sphere:
+            moving_spheres[i].moving_sphere::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::xy_rect:
+            xy_rects[i].xy_rect::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::xz_rect:
+            xz_rects[i].xz_rect::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::yz_rect:
+            yz_rects[i].yz_rect::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::box:
+            boxes[i].::box::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        case primitive_type::sphere_set:
+            sphere_sets[i].sphere_set::compute_surface_interaction(r, t_min, query, rec);
+            break;
+        default:
+            // The hit may belong to an object inside this one, such as the box in a translate.
+            query.object->compute_surface_interaction(r, t_min, query, rec);
+            break;
+    }
+}
+
+
+#endif
@@ -33,7 +33,23 @@ class constant_medium : public hittable  {
             {}
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        // Draws the scattering distance. The record is built from it alone, so that it is not
+        // drawn again.
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override {
+            rec.t = query.t;
+            rec.p = r.at(rec.t);
+            rec.normal = vec3(1,0,0);  // arbitrary
+            rec.front_face = true;     // also arbitrary
+            rec.mat_ptr = phase_function.get();
+        }
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             return boundary->bounding_box(time0, time1, output_box);
@@ -46,50 +62,53 @@ class constant_medium : public hittable  {
 };
 
 
-bool constant_medium::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+bool constant_medium::hit_closest(
+    const ray& r, double t_min, double t_max, hit_query& query
+) const {
     // Print occasional samples when debugging. To enable, set enableDebug true.
     const bool enableDebug = false;
     const bool debugging = enableDebug && random_double() < 0.00001;
 
-    hit_record rec1, rec2;
+    // Only the distances to the boundary are needed, not its records.
+    hit_query query1, query2;
 
-    if (!boundary->hit(r, -infinity, infinity, rec1))
+    if (!boundary->hit_closest(r, -infinity, infinity, query1))
         return false;
 
-    if (!boundary->hit(r, rec1.t+0.0001, infinity, rec2))
+    if (!boundary->hit_closest(r, query1.t+0.0001, infinity, query2))
         return false;
 
-    if (debugging) std::cerr << "\nt_min=" << rec1.t << ", t_max=" << rec2.t << '\n';
+    auto t1 = query1.t;
+    auto t2 = query2.t;
 
-    if (rec1.t < t_min) rec1.t = t_min;
-    if (rec2.t > t_max) rec2.t = t_max;
+    if (debugging) std::cerr << "\nt_min=" << t1 << ", t_max=" << t2 << '\n';
 
-    if (rec1.t >= rec2.t)
+    if (t1 < t_min) t1 = t_min;
+    if (t2 > t_max) t2 = t_max;
+
+    if (t1 >= t2)
         return false;
 
-    if (rec1.t < 0)
-        rec1.t = 0;
+    if (t1 < 0)
+        t1 = 0;
 
     const auto ray_length = r.direction().length();
-    const auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
+    const auto distance_inside_boundary = (t2 - t1) * ray_length;
     const auto hit_distance = neg_inv_density * log(random_double());
 
     if (hit_distance > distance_inside_boundary)
         return false;
 
-    rec.t = rec1.t + hit_distance / ray_length;
-    rec.p = r.at(rec.t);
+    query.t = t1 + hit_distance / ray_length;
+    query.object = this;
+    query.index = 0;
 
     if (debugging) {
         std::cerr << "hit_distance = " <<  hit_distance << '\n'
-                  << "rec.t = " <<  rec.t << '\n'
-                  << "rec.p = " <<  rec.p << '\n';
+                  << "t = " <<  query.t << '\n'
+                  << "p = " <<  r.at(query.t) << '\n';
     }
 
-    rec.normal = vec3(1,0,0);  // arbitrary
-    rec.front_face = true;     // also arbitrary
-    rec.mat_ptr = phase_function;
-
     return true;
 }
 
@@ -14,6 +14,7 @@
 #include "rtweekend.h"
 
 #include "aabb.h"
+#include "ray_packet.h"
 
 
 class material;
@@ -22,7 +23,7 @@ class material;
 struct hit_record {
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat_ptr;
+    const material* mat_ptr;  // Not owned: the scene keeps its materials alive
     double t;
     double u;
     double v;
@@ -35,12 +36,136 @@ struct hit_record {
 };
 
 
+class hittable;
+
+
+struct hit_query {
+    // The closest hit found by hittable::hit_closest(): its distance along the ray, and the
+    // object to ask for the rest of its record. For an object that holds many primitives, such
+    // as a sphere_set, index says which one was hit.
+    double t;
+    const hittable* object;
+    size_t index;
+
+    // The objects, and their indices, hit inside the wrappers that hold them, such as
+    // translate or instance, so that compute_surface_interaction() asks them for the record
+    // instead of tracing the ray again. A second trace could miss an object that draws a random
+    // distance, such as constant_medium. Each wrapper hit pushes the object it found, so the
+    // last entry belongs to query.object when that is the wrapper that pushed last. Only
+    // wrappers, through hittable::wrap_hit() and hittable::wrapped_query(), set or read these.
+    static const int max_wrapped = 8;
+    const hittable* wrapped_object[max_wrapped];
+    size_t wrapped_index[max_wrapped];
+    int wrapped_count;
+    const hittable* wrapper;
+
+    hit_query() : wrapper(nullptr) {}
+};
+
+
 class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const = 0;
+
+        // Intersect the rays of the given packet lanes. For each lane k that hits closer than
+        // t_max[k], writes rec[k], lowers t_max[k] to the hit distance and sets bit k of the
+        // result. Other lanes are left alone. The default traces the lanes one at a time;
+        // primitives and BVHs override it to test groups of lanes at once.
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const;
+
+        // Intersection in two phases. hit_closest() finds only the distance to the closest hit
+        // and the object it belongs to, leaving query alone on a miss; then that object's
+        // compute_surface_interaction() fills in the record of the one hit. Searches that pass
+        // over many candidates, such as BVH traversal, so skip the normals, texture coordinates
+        // and record copies of the ones they discard. The defaults fall back on hit():
+        // hit_closest() runs it in full, and compute_surface_interaction() runs it again over
+        // [t_min, query.t], which finds the same hit for any object whose hit() gives the same
+        // answer each time. Objects whose hit() draws random numbers must override both.
+        virtual bool hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const {
+            hit(r, t_min, query.t, rec);
+        }
+
+        // Whether anything blocks the ray within [t_min, t_max]. Unlike hit_closest(), this may
+        // stop at the first hit it finds, whichever that is, for shadow rays and light sampling
+        // that need only visibility. The default asks hit_closest().
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            hit_query query;
+            return hit_closest(r, t_min, t_max, query);
+        }
+
+    protected:
+        // A hit() for objects whose hit_closest() does less work than hit() would.
+        bool hit_in_two_phases(const ray& r, double t_min, double t_max, hit_record& rec) const {
+            hit_query query;
+            if (!hit_closest(r, t_min, t_max, query))
+                return false;
+            query.object->compute_surface_interaction(r, t_min, query, rec);
+            return true;
+        }
+
+        // For wrappers, after the wrapped object's hit_closest() has found a hit in inner: make
+        // this wrapper the object hit in query, and push the wrapped object for
+        // compute_surface_interaction() to pass on to. Leaves query alone and returns false,
+        // dropping the hit, when more wrappers are nested than a query can hold.
+        bool wrap_hit(const hit_query& inner, hit_query& query) const {
+            auto count = (inner.object == inner.wrapper) ? inner.wrapped_count : 0;
+            if (count == hit_query::max_wrapped)
+                return false;
+
+            query = inner;
+            query.wrapped_object[count] = inner.object;
+            query.wrapped_index[count] = inner.index;
+            query.wrapped_count = count + 1;
+            query.wrapper = this;
+            query.object = this;
+            query.index = 0;
+            return true;
+        }
+
+        // For wrappers: the query of the object hit inside this one, as wrap_hit() pushed it.
+        static hit_query wrapped_query(const hit_query& query) {
+            hit_query inner = query;
+            inner.wrapped_count = query.wrapped_count - 1;
+            inner.object = query.wrapped_object[inner.wrapped_count];
+            inner.index = query.wrapped_index[inner.wrapped_count];
+            return inner;
+        }
 };
 
+unsigned hittable::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    unsigned hits = 0;
+    for (int k = 0; k < rays.size; k++) {
+        hit_record temp_rec;
+        if ((lanes >> k) & 1 && hit(rays.get(k), t_min, t_max[k], temp_rec)) {
+            rec[k] = temp_rec;
+            t_max[k] = temp_rec.t;
+            hits |= 1u << k;
+        }
+    }
+    return hits;
+}
+
+
+bool hittable::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    hit_record rec;
+    if (!hit(r, t_min, t_max, rec))
+        return false;
+
+    query.t = rec.t;
+    query.object = this;
+    query.index = 0;
+    return true;
+}
+
+
 class translate : public hittable {
     public:
         translate(shared_ptr<hittable> p, const vec3& displacement)
@@ -49,6 +174,20 @@ class translate : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(ray(r.origin() - offset, r.direction(), r.time()), t_min, t_max);
+        }
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
     public:
@@ -69,6 +208,47 @@ bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) c
 }
 
 
+bool translate::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    hit_query inner;
+    return ptr->hit_closest(moved_r, t_min, t_max, inner) && wrap_hit(inner, query);
+}
+
+
+void translate::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    ray moved_r(r.origin() - offset, r.direction(), r.time());
+    auto inner = wrapped_query(query);
+    inner.object->compute_surface_interaction(moved_r, t_min, inner, rec);
+
+    rec.p += offset;
+    rec.set_face_normal(moved_r, rec.normal);
+}
+
+
+unsigned translate::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    ray_packet moved = rays;
+    for (int k = 0; k < rays.size; k++) {
+        for (int a = 0; a < 3; a++)
+            moved.origin[a][k] = rays.origin[a][k] - offset[a];
+        moved.prepare(k);
+    }
+
+    auto hits = ptr->hit_packet(moved, lanes, t_min, t_max, rec);
+    for (int k = 0; k < rays.size; k++) {
+        if ((hits >> k) & 1) {
+            rec[k].p += offset;
+            rec[k].set_face_normal(moved.get(k), rec[k].normal);
+        }
+    }
+
+    return hits;
+}
+
+
 bool translate::bounding_box(double time0, double time1, aabb& output_box) const {
     if (!ptr->bounding_box(time0, time1, output_box))
         return false;
@@ -88,6 +268,20 @@ class rotate_y : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(rotate_ray(r), t_min, t_max);
+        }
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             output_box = bbox;
             return hasbox;
@@ -99,6 +293,10 @@ class rotate_y : public hittable {
         double cos_theta;
         bool hasbox;
         aabb bbox;
+
+    private:
+        ray rotate_ray(const ray& r) const;
+        void rotate_record(const ray& rotated_r, hit_record& rec) const;
 };
 
 
@@ -136,6 +334,57 @@ rotate_y::rotate_y(shared_ptr<hittable> p, double angle) : ptr(p) {
 
 
 bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    auto rotated_r = rotate_ray(r);
+
+    if (!ptr->hit(rotated_r, t_min, t_max, rec))
+        return false;
+
+    rotate_record(rotated_r, rec);
+    return true;
+}
+
+
+bool rotate_y::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    hit_query inner;
+    return ptr->hit_closest(rotate_ray(r), t_min, t_max, inner) && wrap_hit(inner, query);
+}
+
+
+void rotate_y::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto rotated_r = rotate_ray(r);
+    auto inner = wrapped_query(query);
+    inner.object->compute_surface_interaction(rotated_r, t_min, inner, rec);
+    rotate_record(rotated_r, rec);
+}
+
+
+unsigned rotate_y::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    ray_packet rotated = rays;
+    for (int k = 0; k < rays.size; k++) {
+        rotated.origin[0][k] = cos_theta*rays.origin[0][k] - sin_theta*rays.origin[2][k];
+        rotated.origin[2][k] = sin_theta*rays.origin[0][k] + cos_theta*rays.origin[2][k];
+
+        rotated.direction[0][k] = cos_theta*rays.direction[0][k] - sin_theta*rays.direction[2][k];
+        rotated.direction[2][k] = sin_theta*rays.direction[0][k] + cos_theta*rays.direction[2][k];
+
+        rotated.prepare(k);
+    }
+
+    auto hits = ptr->hit_packet(rotated, lanes, t_min, t_max, rec);
+    for (int k = 0; k < rays.size; k++)
+        if ((hits >> k) & 1)
+            rotate_record(rotated.get(k), rec[k]);
+
+    return hits;
+}
+
+
+ray rotate_y::rotate_ray(const ray& r) const {
+    // Turns a world space ray into the rotated frame.
     auto origin = r.origin();
     auto direction = r.direction();
 
@@ -145,11 +394,12 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     direction[0] = cos_theta*r.direction()[0] - sin_theta*r.direction()[2];
     direction[2] = sin_theta*r.direction()[0] + cos_theta*r.direction()[2];
 
-    ray rotated_r(origin, direction, r.time());
+    return ray(origin, direction, r.time());
+}
 
-    if (!ptr->hit(rotated_r, t_min, t_max, rec))
-        return false;
 
+void rotate_y::rotate_record(const ray& rotated_r, hit_record& rec) const {
+    // Turns a hit found in the rotated frame back into world space.
     auto p = rec.p;
     auto normal = rec.normal;
 
@@ -161,8 +411,6 @@ bool rotate_y::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
 
     rec.p = p;
     rec.set_face_normal(rotated_r, normal);
-
-    return true;
 }
 
 
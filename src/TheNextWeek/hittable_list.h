@@ -28,7 +28,18 @@ class hittable_list : public hittable  {
         void add(shared_ptr<hittable> object) { objects.push_back(object); }
 
         virtual bool hit(
-            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
@@ -37,16 +48,16 @@ class hittable_list : public hittable  {
 };
 
 
-bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    hit_record temp_rec;
+bool hittable_list::hit_closest(
+    const ray& r, double t_min, double t_max, hit_query& query
+) const {
     auto hit_anything = false;
     auto closest_so_far = t_max;
 
     for (const auto& object : objects) {
-        if (object->hit(r, t_min, closest_so_far, temp_rec)) {
+        if (object->hit_closest(r, t_min, closest_so_far, query)) {
             hit_anything = true;
-            closest_so_far = temp_rec.t;
-            rec = temp_rec;
+            closest_so_far = query.t;
         }
     }
 
@@ -54,6 +65,26 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 }
 
 
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const {
+    for (const auto& object : objects)
+        if (object->occluded(r, t_min, t_max))
+            return true;
+
+    return false;
+}
+
+
+unsigned hittable_list::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // Each object lowers t_max for the lanes it hits, so later objects only report closer hits.
+    unsigned hits = 0;
+    for (const auto& object : objects)
+        hits |= object->hit_packet(rays, lanes, t_min, t_max, rec);
+    return hits;
+}
+
+
 bool hittable_list::bounding_box(double time0, double time1, aabb& output_box) const {
     if (objects.empty()) return false;
 
@@ -0,0 +1,272 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+struct linear_bvh_node {
+    // A 32-byte BVH node, so that two nodes fill a 64-byte cache line. Interior nodes are stored
+    // in depth-first order: the first child immediately follows its parent, and the offset gives
+    // the index of the second child. Leaves instead hold a run of primitive indices.
+    float bounds[2][3];        // Minimum and maximum corners, rounded outward
+    uint32_t offset;           // Interior: second child index. Leaf: first primitive index.
+    uint16_t primitive_count;  // Zero for interior nodes
+    uint8_t axis;              // Split axis of an interior node
+    uint8_t pad;
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must be 32 bytes");
+
+
+class linear_bvh : public hittable {
+    public:
+        linear_bvh(
+            const hittable_list& list, double time0, double time1,
+            bvh_split split = bvh_split::sah);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override {
+            return traverse<false, false>(r, t_min, t_max, query, nullptr);
+        }
+
+        // Stops at the first primitive hit, in whatever order the traversal reaches it.
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            hit_query query;
+            return traverse<false, true>(r, t_min, t_max, query, nullptr);
+        }
+
+        // Like hit(), but also counts the work done into counts.
+        bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec,
+            traversal_stats& counts) const {
+            hit_query query;
+            if (!traverse<true, false>(r, t_min, t_max, query, &counts))
+                return false;
+            query.object->compute_surface_interaction(r, t_min, query, rec);
+            return true;
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = box;
+            return true;
+        }
+
+        bvh_stats stats() const;
+
+        size_t node_count() const { return count; }
+        const linear_bvh_node& node(size_t i) const { return nodes[i]; }
+
+    public:
+        std::vector<shared_ptr<hittable>> objects;  // Owned primitives, in leaf order
+        aabb box;
+
+    private:
+        static const int max_leaf_primitives = 4;
+
+        std::unique_ptr<unsigned char[]> storage;
+        linear_bvh_node* nodes;           // Cache-line aligned view of storage
+        size_t count;
+        std::vector<const hittable*> primitives;  // Non-owning copies of objects, for traversal
+
+        // Finds the closest hit, or with AnyHit, whether there is any hit at all.
+        template <bool Count, bool AnyHit>
+        bool traverse(
+            const ray& r, double t_min, double t_max, hit_query& query,
+            traversal_stats* counts) const;
+};
+
+
+inline float round_down(double x) {
+    auto f = static_cast<float>(x);
+    return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+
+inline float round_up(double x) {
+    auto f = static_cast<float>(x);
+    return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+
+linear_bvh::linear_bvh(
+    const hittable_list& list, double time0, double time1, bvh_split split
+) : nodes(nullptr), count(0) {
+    // The random axis split keeps to the binary tree's leaves of at most two objects.
+    auto leaf_limit = (split == bvh_split::sah) ? max_leaf_primitives : 2;
+    bvh_builder builder(list.objects, 0, list.objects.size(), time0, time1, split, leaf_limit);
+
+    objects.reserve(builder.order.size());
+    for (auto index : builder.order)
+        objects.push_back(list.objects[index]);
+    for (const auto& object : objects)
+        primitives.push_back(object.get());
+
+    // Convert the nodes to their compact form, in storage aligned to a 64-byte cache line.
+    count = builder.nodes.empty() ? 1 : builder.nodes.size();
+    void* aligned_start;
+    size_t space = count * sizeof(linear_bvh_node) + 64;
+    storage.reset(new unsigned char[space]);
+    aligned_start = storage.get();
+    nodes = static_cast<linear_bvh_node*>(
+        std::align(64, count * sizeof(linear_bvh_node), aligned_start, space));
+
+    if (builder.nodes.empty()) {
+        linear_bvh_node empty_leaf = {{{1,1,1}, {0,0,0}}, 0, 0, 0, 0};
+        nodes[0] = empty_leaf;
+    }
+
+    for (size_t i = 0; i < builder.nodes.size(); i++) {
+        const auto& built = builder.nodes[i];
+        auto& node = nodes[i];
+        for (int a = 0; a < 3; a++) {
+            node.bounds[0][a] = round_down(built.box.min()[a]);
+            node.bounds[1][a] = round_up(built.box.max()[a]);
+        }
+        node.offset = static_cast<uint32_t>(built.offset);
+        node.primitive_count = static_cast<uint16_t>(built.count);
+        node.axis = static_cast<uint8_t>(built.count == 0 ? built.axis : 0);
+        node.pad = 0;
+    }
+
+    const auto& root = nodes[0];
+    box = aabb(point3(root.bounds[0][0], root.bounds[0][1], root.bounds[0][2]),
+               point3(root.bounds[1][0], root.bounds[1][1], root.bounds[1][2]));
+}
+
+
+template <bool Count, bool AnyHit>
+bool linear_bvh::traverse(
+    const ray& r, double t_min, double t_max, hit_query& query, traversal_stats* counts
+) const {
+    // Slab tests run in single precision against boxes that were rounded outward; the padded
+    // far reciprocal in ray_traversal keeps rounding in the test from losing a hit.
+    ray_traversal<float> traversal(r);
+
+    if (Count)
+        counts->rays++;
+
+    auto closest_so_far = t_max;
+    bool hit_anything = false;
+
+    uint32_t stack[64];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+
+        if (Count) {
+            counts->nodes_visited++;
+            counts->box_tests++;
+        }
+
+        auto t_near = static_cast<float>(t_min);
+        auto t_far  = static_cast<float>(closest_so_far);
+        for (int a = 0; a < 3; a++) {
+            auto neg = traversal.is_neg[a];
+            auto t0 = (node.bounds[neg][a]     - traversal.origin[a]) * traversal.inv_dir[a];
+            auto t1 = (node.bounds[1 - neg][a] - traversal.origin[a]) * traversal.far_inv_dir[a];
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far  = t1 < t_far  ? t1 : t_far;
+        }
+
+        if (t_near <= t_far) {
+            if (node.primitive_count > 0) {
+                if (Count)
+                    counts->primitive_tests += node.primitive_count;
+
+                for (uint32_t i = 0; i < node.primitive_count; i++) {
+                    auto primitive = primitives[node.offset + i];
+                    if (AnyHit) {
+                        if (primitive->occluded(r, t_min, t_max))
+                            return true;
+                    } else if (primitive->hit_closest(r, t_min, closest_so_far, query)) {
+                        hit_anything = true;
+                        closest_so_far = query.t;
+                    }
+                }
+            } else {
+                // Visit the child nearer the ray origin first, so that closer hits shrink the
+                // search distance before the farther child is tested.
+                if (traversal.is_neg[node.axis]) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                }
+                continue;
+            }
+        }
+
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+
+bvh_stats linear_bvh::stats() const {
+    bvh_stats stats;
+
+    auto area = [](const linear_bvh_node& n) {
+        auto a = n.bounds[1][0] - n.bounds[0][0];
+        auto b = n.bounds[1][1] - n.bounds[0][1];
+        auto c = n.bounds[1][2] - n.bounds[0][2];
+        return 2.0*(a*b + b*c + c*a);
+    };
+
+    auto root_area = area(nodes[0]);
+
+    struct entry { uint32_t index; int depth; };
+    std::vector<entry> pending = { {0, 1} };
+
+    while (!pending.empty()) {
+        auto e = pending.back();
+        pending.pop_back();
+
+        const auto& n = nodes[e.index];
+        auto p = area(n) / root_area;
+
+        stats.node_count++;
+        stats.max_depth = std::max(stats.max_depth, e.depth);
+        stats.box_tests += p;
+
+        if (n.primitive_count > 0) {
+            stats.primitive_tests += p * n.primitive_count;
+        } else {
+            pending.push_back({e.index + 1, e.depth + 1});
+            pending.push_back({n.offset, e.depth + 1});
+        }
+    }
+
+    return stats;
+}
+
+
+#endif
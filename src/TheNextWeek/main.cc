@@ -11,264 +11,68 @@
 
 #include "rtweekend.h"
 
-#include "box.h"
-#include "bvh.h"
 #include "camera.h"
 #include "color.h"
-#include "constant_medium.h"
+#include "compiled_scene.h"
 #include "hittable_list.h"
 #include "material.h"
-#include "moving_sphere.h"
-#include "sphere.h"
-#include "texture.h"
+#include "render.h"
+#include "scene_compiler.h"
+#include "scenes.h"
 
 #include <iostream>
 
 
-color ray_color(const ray& r, const color& background, const hittable& world, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
-
-    ray scattered;
-    color attenuation;
-    color emitted = rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
-
-    if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-        return emitted;
-
-    return emitted + attenuation * ray_color(scattered, background, world, depth-1);
-}
-
-
-hittable_list random_scene() {
-    hittable_list world;
-
-    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(checker)));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9*random_double(), 0.2, b + 0.9*random_double());
-
-            if ((center - vec3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    auto center2 = center + vec3(0, random_double(0,.5), 0);
-                    world.add(make_shared<moving_sphere>(
-                        center, center2, 0.0, 1.0, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                } else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
-
-    return hittable_list(make_shared<bvh_node>(world, 0.0, 1.0));
-}
-
-
-hittable_list two_spheres() {
-    hittable_list objects;
-
-    auto checker = make_shared<checker_texture>(color(0.2, 0.3, 0.1), color(0.9, 0.9, 0.9));
-
-    objects.add(make_shared<sphere>(point3(0,-10, 0), 10, make_shared<lambertian>(checker)));
-    objects.add(make_shared<sphere>(point3(0, 10, 0), 10, make_shared<lambertian>(checker)));
-
-    return objects;
-}
-
-
-hittable_list two_perlin_spheres() {
-    hittable_list objects;
-
-    auto pertext = make_shared<noise_texture>(4);
-    objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-    return objects;
-}
-
-
-hittable_list earth() {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
-
-    return hittable_list(globe);
-}
-
-
-hittable_list simple_light() {
-    hittable_list objects;
-
-    auto pertext = make_shared<noise_texture>(4);
-    objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0,2,0), 2, make_shared<lambertian>(pertext)));
-
-    auto difflight = make_shared<diffuse_light>(color(4,4,4));
-    objects.add(make_shared<sphere>(point3(0,7,0), 2, difflight));
-    objects.add(make_shared<xy_rect>(3, 5, 1, 3, -2, difflight));
-
-    return objects;
-}
-
-
-hittable_list cornell_box() {
-    hittable_list objects;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(15, 15, 15));
-
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<xz_rect>(213, 343, 227, 332, 554, light));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-    objects.add(box1);
-
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-    objects.add(box2);
-
-    return objects;
-}
-
-
-hittable_list cornell_smoke() {
-    hittable_list objects;
-
-    auto red   = make_shared<lambertian>(color(.65, .05, .05));
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    auto green = make_shared<lambertian>(color(.12, .45, .15));
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 555, green));
-    objects.add(make_shared<yz_rect>(0, 555, 0, 555, 0, red));
-    objects.add(make_shared<xz_rect>(113, 443, 127, 432, 554, light));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 555, white));
-    objects.add(make_shared<xz_rect>(0, 555, 0, 555, 0, white));
-    objects.add(make_shared<xy_rect>(0, 555, 0, 555, 555, white));
-
-    shared_ptr<hittable> box1 = make_shared<box>(point3(0,0,0), point3(165,330,165), white);
-    box1 = make_shared<rotate_y>(box1, 15);
-    box1 = make_shared<translate>(box1, vec3(265,0,295));
-
-    shared_ptr<hittable> box2 = make_shared<box>(point3(0,0,0), point3(165,165,165), white);
-    box2 = make_shared<rotate_y>(box2, -18);
-    box2 = make_shared<translate>(box2, vec3(130,0,65));
-
-    objects.add(make_shared<constant_medium>(box1, 0.01, color(0,0,0)));
-    objects.add(make_shared<constant_medium>(box2, 0.01, color(1,1,1)));
-
-    return objects;
-}
-
-
-hittable_list final_scene() {
-    hittable_list boxes1;
-    auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
-
-    const int boxes_per_side = 20;
-    for (int i = 0; i < boxes_per_side; i++) {
-        for (int j = 0; j < boxes_per_side; j++) {
-            auto w = 100.0;
-            auto x0 = -1000.0 + i*w;
-            auto z0 = -1000.0 + j*w;
-            auto y0 = 0.0;
-            auto x1 = x0 + w;
-            auto y1 = random_double(1,101);
-            auto z1 = z0 + w;
-
-            boxes1.add(make_shared<box>(point3(x0,y0,z0), point3(x1,y1,z1), ground));
+color ray_color(
+    ray r,
+    const color& background,
+    const hittable& world,
+    int max_depth,
+    const hit_record* primary = nullptr,
+    bool primary_hit = false
+) {
+    // Follow the path one bounce at a time, adding the light emitted at each hit weighted by the
+    // product of the attenuations so far. If primary is given, the camera ray has already been
+    // traced, in a packet, and primary and primary_hit hold its result.
+    color radiance(0,0,0);
+    color throughput(1,1,1);
+
+    for (int bounce = 1; bounce <= max_depth; bounce++) {
+        // Each bounce draws its random numbers from its own dimensions of the sample stream.
+        set_sample_bounce(bounce);
+        thread_rays_traced()++;
+
+        // If the ray hits nothing, add the background color.
+        hit_record rec;
+        if (bounce == 1 && primary) {
+            if (!primary_hit)
+                return radiance + throughput * background;
+            rec = *primary;
+        } else if (!world.hit(r, 0.001, infinity, rec)) {
+            return radiance + throughput * background;
         }
-    }
-
-    hittable_list objects;
 
-    objects.add(make_shared<bvh_node>(boxes1, 0, 1));
+        ray scattered;
+        color attenuation;
+        radiance += throughput * rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
 
-    auto light = make_shared<diffuse_light>(color(7, 7, 7));
-    objects.add(make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+        if (!rec.mat_ptr->scatter(r, rec, attenuation, scattered))
+            return radiance;
 
-    auto center1 = point3(400, 400, 200);
-    auto center2 = center1 + vec3(30,0,0);
-    auto moving_sphere_material = make_shared<lambertian>(color(0.7, 0.3, 0.1));
-    objects.add(make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+        throughput = throughput * attenuation;
+        if (!survives_russian_roulette(throughput, bounce))
+            return radiance;
 
-    objects.add(make_shared<sphere>(point3(260, 150, 45), 50, make_shared<dielectric>(1.5)));
-    objects.add(make_shared<sphere>(
-        point3(0, 150, 145), 50, make_shared<metal>(color(0.8, 0.8, 0.9), 1.0)
-    ));
-
-    auto boundary = make_shared<sphere>(point3(360,150,145), 70, make_shared<dielectric>(1.5));
-    objects.add(boundary);
-    objects.add(make_shared<constant_medium>(boundary, 0.2, color(0.2, 0.4, 0.9)));
-    boundary = make_shared<sphere>(point3(0,0,0), 5000, make_shared<dielectric>(1.5));
-    objects.add(make_shared<constant_medium>(boundary, .0001, color(1,1,1)));
-
-    auto emat = make_shared<lambertian>(make_shared<image_texture>("earthmap.jpg"));
-    objects.add(make_shared<sphere>(point3(400,200,400), 100, emat));
-    auto pertext = make_shared<noise_texture>(0.1);
-    objects.add(make_shared<sphere>(point3(220,280,300), 80, make_shared<lambertian>(pertext)));
-
-    hittable_list boxes2;
-    auto white = make_shared<lambertian>(color(.73, .73, .73));
-    int ns = 1000;
-    for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<sphere>(point3::random(0,165), 10, white));
+        r = scattered;
     }
 
-    objects.add(make_shared<translate>(
-        make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-            vec3(-100,270,395)
-        )
-    );
-
-    return objects;
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    return radiance;
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    auto options = parse_render_options(argc, argv);
 
     // Image
 
@@ -287,9 +91,9 @@ int main() {
     auto aperture = 0.0;
     color background(0,0,0);
 
-    switch (0) {
+    switch (options.scene) {
         case 1:
-            world = random_scene();
+            world = random_scene(bvh_split::sah, options.bvh_width);
             background = color(0.70, 0.80, 1.00);
             lookfrom = point3(13,2,3);
             lookat = point3(0,0,0);
@@ -351,7 +155,7 @@ int main() {
             break;
 
         case 8:
-            world = final_scene();
+            world = final_scene(bvh_split::sah, options.bvh_width);
             aspect_ratio = 1.0;
             image_width = 800;
             samples_per_pixel = 10000;
@@ -359,6 +163,22 @@ int main() {
             lookat = point3(278, 278, 0);
             vfov = 40.0;
             break;
+
+        case 9:
+            world = instanced_scene(bvh_split::sah, options.bvh_width);
+            background = color(0.70, 0.80, 1.00);
+            lookfrom = point3(0, 14, -60);
+            lookat = point3(0, 0, 0);
+            vfov = 40.0;
+            break;
+    }
+
+    world = compile_scene(world, 0.0, 1.0, options.bvh_width);
+
+    if (options.compiled) {
+        auto compiled = make_shared<compiled_scene>(world, 0.0, 1.0);
+        world = hittable_list(compiled);
+        std::cerr << "Compiled the scene into " << compiled->node_count() << " BVH nodes.\n";
     }
 
     // Camera
@@ -371,21 +191,21 @@ int main() {
 
     // Render
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0,0,0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
-        }
-    }
+    tile_renderer renderer(image_width, image_height, samples_per_pixel, options);
+
+    renderer.render_packets<hit_record>(
+        [&](double u, double v) { return cam.get_ray(u, v); },
+        [&](const ray_packet& rays, unsigned lanes, hit_record* hits) {
+            double t_max[ray_packet::max_size];
+            std::fill(t_max, t_max + ray_packet::max_size, infinity);
+            return world.hit_packet(rays, lanes, 0.001, t_max, hits);
+        },
+        [&](const ray& r, const hit_record* primary, bool primary_hit) {
+            return ray_color(r, background, world, max_depth, primary, primary_hit);
+        });
+
+    if (!renderer.write_image())
+        return 1;
 
     std::cerr << "\nDone.\n";
 }
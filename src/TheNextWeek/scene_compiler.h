@@ -0,0 +1,132 @@
+#ifndef SCENE_COMPILER_H
+#define SCENE_COMPILER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh_build.h"
+#include "constant_medium.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+
+#include <typeinfo>
+
+
+shared_ptr<hittable> make_bvh(
+    const hittable_list& list, double time0, double time1, bvh_split split, int width
+) {
+    // Builds the BVH layout with the given number of children per node.
+    switch (width) {
+        case 2:  return make_shared<linear_bvh>(list, time0, time1, split);
+        case 8:  return make_shared<wide_bvh<8>>(list, time0, time1, split);
+        default: return make_shared<wide_bvh<4>>(list, time0, time1, split);
+    }
+}
+
+
+// Scene compilation: rewrites a scene into an equivalent one that is quicker to trace, so that
+// scenes can be written plainly and still be accelerated.
+//
+//  - Nested lists are merged into the list that holds them, and a list of more objects than
+//    fit in one BVH leaf is replaced by a BVH over them, of the given width.
+//  - A chain of translate and rotate_y wrappers becomes one instance, whose single affine
+//    transform is their composition.
+//  - The boundary of a constant_medium is compiled in turn.
+//
+// BVHs already in the scene are kept as they are. The objects are shared with the original
+// scene, not copied, so it must not be changed afterwards.
+
+const size_t compiled_list_limit = 4;  // Longest list left without a BVH
+
+
+shared_ptr<hittable> compile_object(
+    const shared_ptr<hittable>& object, double time0, double time1, int bvh_width);
+
+
+void gather_compiled(
+    const hittable_list& list, double time0, double time1, int bvh_width, hittable_list& out
+) {
+    for (const auto& object : list.objects) {
+        if (typeid(*object) == typeid(hittable_list))
+            gather_compiled(static_cast<const hittable_list&>(*object), time0, time1, bvh_width,
+                            out);
+        else
+            out.add(compile_object(object, time0, time1, bvh_width));
+    }
+}
+
+
+hittable_list compile_scene(
+    const hittable_list& scene, double time0, double time1, int bvh_width = 4
+) {
+    hittable_list compiled;
+    gather_compiled(scene, time0, time1, bvh_width, compiled);
+
+    if (compiled.objects.size() <= compiled_list_limit)
+        return compiled;
+    return hittable_list(make_bvh(compiled, time0, time1, bvh_split::sah, bvh_width));
+}
+
+
+shared_ptr<hittable> compile_object(
+    const shared_ptr<hittable>& object, double time0, double time1, int bvh_width
+) {
+    const auto& type = typeid(*object);
+
+    if (type == typeid(hittable_list)) {
+        auto list = compile_scene(
+            static_cast<const hittable_list&>(*object), time0, time1, bvh_width);
+        if (list.objects.size() == 1)
+            return list.objects[0];
+        return make_shared<hittable_list>(list);
+    }
+
+    if (type == typeid(translate) || type == typeid(rotate_y)) {
+        // Walk in from the outermost wrapper, adding each one's transform before the rest.
+        auto transform = affine::identity();
+        auto inner = object;
+        while (true) {
+            if (typeid(*inner) == typeid(translate)) {
+                const auto& wrapper = static_cast<const translate&>(*inner);
+                transform = affine::translation(wrapper.offset).then(transform);
+                inner = wrapper.ptr;
+            } else if (typeid(*inner) == typeid(rotate_y)) {
+                const auto& wrapper = static_cast<const rotate_y&>(*inner);
+                transform = affine::rotation_y(wrapper.sin_theta, wrapper.cos_theta)
+                            .then(transform);
+                inner = wrapper.ptr;
+            } else {
+                break;
+            }
+        }
+
+        inner = compile_object(inner, time0, time1, bvh_width);
+        if (typeid(*inner) == typeid(instance)) {
+            const auto& nested = static_cast<const instance&>(*inner);
+            transform = nested.transform.then(transform);
+            inner = nested.ptr;
+        }
+        return make_shared<instance>(inner, transform);
+    }
+
+    if (type == typeid(constant_medium)) {
+        auto medium = make_shared<constant_medium>(static_cast<const constant_medium&>(*object));
+        medium->boundary = compile_object(medium->boundary, time0, time1, bvh_width);
+        return medium;
+    }
+
+    return object;
+}
+
+
+#endif
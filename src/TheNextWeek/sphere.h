@@ -26,6 +26,23 @@ class sphere : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override {
+            set_hit_record(r, query.t, rec);
+        }
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double root;
+            return find_root(r, t_min, t_max, root);
+        }
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
 
     public:
@@ -34,6 +51,9 @@ class sphere : public hittable {
         shared_ptr<material> mat_ptr;
 
     private:
+        bool find_root(const ray& r, double t_min, double t_max, double& root) const;
+        void set_hit_record(const ray& r, double root, hit_record& rec) const;
+
         static void get_sphere_uv(const point3& p, double& u, double& v) {
             // p: a given point on the sphere of radius one, centered at the origin.
             // u: returned value [0,1] of angle around the Y axis from X=-1.
@@ -60,6 +80,28 @@ bool sphere::bounding_box(double time0, double time1, aabb& output_box) const {
 
 
 bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    double root;
+    if (!find_root(r, t_min, t_max, root))
+        return false;
+
+    set_hit_record(r, root, rec);
+    return true;
+}
+
+
+bool sphere::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    double root;
+    if (!find_root(r, t_min, t_max, root))
+        return false;
+
+    query.t = root;
+    query.object = this;
+    query.index = 0;
+    return true;
+}
+
+
+bool sphere::find_root(const ray& r, double t_min, double t_max, double& root) const {
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -70,21 +112,73 @@ bool sphere::hit(const ray& r, double t_min, double t_max, hit_record& rec) cons
     auto sqrtd = sqrt(discriminant);
 
     // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (root < t_min || t_max < root) {
         root = (-half_b + sqrtd) / a;
         if (root < t_min || t_max < root)
             return false;
     }
 
+    return true;
+}
+
+
+unsigned sphere::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // The same arithmetic as hit(), across each group of lanes at once. Roots are found in a
+    // loop the compiler vectorizes; only the lanes that hit go on to build a record.
+    double roots[ray_packet::max_size];
+    bool found[ray_packet::max_size];
+
+    for (int g = 0; g < rays.size; g += ray_packet::group_size) {
+        if (!lane_group_mask(lanes, g))
+            continue;
+
+        for (int k = g; k < g + ray_packet::group_size; k++) {
+            auto ocx = rays.origin[0][k] - center.e[0];
+            auto ocy = rays.origin[1][k] - center.e[1];
+            auto ocz = rays.origin[2][k] - center.e[2];
+            auto dx = rays.direction[0][k];
+            auto dy = rays.direction[1][k];
+            auto dz = rays.direction[2][k];
+
+            auto a = dx*dx + dy*dy + dz*dz;
+            auto half_b = ocx*dx + ocy*dy + ocz*dz;
+            auto c = (ocx*ocx + ocy*ocy + ocz*ocz) - radius*radius;
+
+            auto discriminant = half_b*half_b - a*c;
+            auto sqrtd = sqrt(discriminant < 0 ? 0 : discriminant);
+
+            auto near_root = (-half_b - sqrtd) / a;
+            auto far_root  = (-half_b + sqrtd) / a;
+            auto near_ok = !(near_root < t_min || t_max[k] < near_root);
+            auto far_ok  = !(far_root  < t_min || t_max[k] < far_root);
+
+            roots[k] = near_ok ? near_root : far_root;
+            found[k] = discriminant >= 0 && (near_ok || far_ok);
+        }
+    }
+
+    unsigned hits = 0;
+    for (int k = 0; k < rays.size; k++) {
+        if ((lanes >> k) & 1 && found[k]) {
+            set_hit_record(rays.get(k), roots[k], rec[k]);
+            t_max[k] = roots[k];
+            hits |= 1u << k;
+        }
+    }
+    return hits;
+}
+
+
+void sphere::set_hit_record(const ray& r, double root, hit_record& rec) const {
     rec.t = root;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     get_sphere_uv(outward_normal, rec.u, rec.v);
-    rec.mat_ptr = mat_ptr;
-
-    return true;
+    rec.mat_ptr = mat_ptr.get();
 }
 
 
@@ -0,0 +1,394 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "moving_sphere.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+struct sphere_block {
+    // The hot data of sphere_set::block_size spheres, stored by field so that one ray can test
+    // them all at once. A moving sphere's center at time t is center + s*motion, where
+    // s = (t - start_time) / duration, exactly as moving_sphere::center() computes it; a still
+    // sphere has no motion. Unused slots have NaN centers, which never hit.
+    double center[3][4];
+    double motion[3][4];
+    double start_time[4];
+    double duration[4];
+    double radius_squared[4];
+    bool moving;  // Whether any sphere of the block moves; if not, the motion is skipped
+};
+
+
+class sphere_set : public hittable {
+    // Many spheres in one primitive. Their centers and radii are stored in blocks of four, and
+    // a ray is tested against a whole block at once: four spheres to an AVX instruction, or two
+    // to an SSE2 one. Materials are shared through a table, and each sphere keeps an index into
+    // it. Intersections match sphere::hit() and moving_sphere::hit() exactly.
+    //
+    // A sphere_set serves as a BVH leaf: pack_sphere_sets() gathers spheres that lie close
+    // together into one set, so the BVH above them is smaller and each leaf holds many spheres.
+    public:
+        static const int block_size = 4;
+
+        sphere_set() {}
+
+        void add(const point3& center, double radius, shared_ptr<material> m);
+        void add(
+            const point3& center0, const point3& center1, double time0, double time1,
+            double radius, shared_ptr<material> m);
+
+        // Adds a sphere or moving_sphere. Returns false, and adds nothing, for anything else.
+        bool add(const shared_ptr<hittable>& object);
+
+        size_t size() const { return radius.size(); }
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = box;
+            return !radius.empty();
+        }
+
+    public:
+        std::vector<sphere_block> blocks;
+        std::vector<double> radius;                    // Per sphere
+        std::vector<uint32_t> material_id;             // Per sphere, into materials
+        std::vector<shared_ptr<material>> materials;
+        aabb box;                                      // Over every time
+
+    private:
+        void add_slot(
+            const point3& center, const vec3& motion, double start_time, double duration,
+            double radius, shared_ptr<material> m, const aabb& bounds);
+
+        // Tests the spheres of one block against the ray. Returns the mask of the spheres hit
+        // within [t_min, t_max], and writes each one's nearest root in that range.
+        unsigned hit_block(
+            const sphere_block& block, const ray& r, double t_min, double t_max,
+            double roots[block_size]) const;
+
+        point3 center(size_t i, double time) const;
+
+        static void get_sphere_uv(const point3& p, double& u, double& v) {
+            // As sphere::get_sphere_uv.
+            auto theta = acos(-p.y());
+            auto phi = atan2(-p.z(), p.x()) + pi;
+
+            u = phi / (2*pi);
+            v = theta / pi;
+        }
+};
+
+
+void sphere_set::add(const point3& center, double r, shared_ptr<material> m) {
+    auto extent = vec3(r, r, r);
+    add_slot(center, vec3(0,0,0), 0, 1, r, m, aabb(center - extent, center + extent));
+}
+
+
+void sphere_set::add(
+    const point3& center0, const point3& center1, double time0, double time1,
+    double r, shared_ptr<material> m
+) {
+    moving_sphere moving(center0, center1, time0, time1, r, m);
+    aabb bounds;
+    moving.bounding_box(time0, time1, bounds);
+    add_slot(center0, center1 - center0, time0, time1 - time0, r, m, bounds);
+}
+
+
+bool sphere_set::add(const shared_ptr<hittable>& object) {
+    if (auto s = std::dynamic_pointer_cast<sphere>(object)) {
+        add(s->center, s->radius, s->mat_ptr);
+        return true;
+    }
+    if (auto s = std::dynamic_pointer_cast<moving_sphere>(object)) {
+        add(s->center0, s->center1, s->time0, s->time1, s->radius, s->mat_ptr);
+        return true;
+    }
+    return false;
+}
+
+
+void sphere_set::add_slot(
+    const point3& center, const vec3& motion, double start_time, double duration,
+    double r, shared_ptr<material> m, const aabb& bounds
+) {
+    auto slot = size() % block_size;
+    if (slot == 0) {
+        sphere_block block;
+        auto nan = std::numeric_limits<double>::quiet_NaN();
+        for (int i = 0; i < block_size; i++) {
+            for (int a = 0; a < 3; a++) {
+                block.center[a][i] = nan;
+                block.motion[a][i] = 0;
+            }
+            block.start_time[i] = 0;
+            block.duration[i] = 1;
+            block.radius_squared[i] = nan;
+        }
+        block.moving = false;
+        blocks.push_back(block);
+    }
+
+    auto& block = blocks.back();
+    for (int a = 0; a < 3; a++) {
+        block.center[a][slot] = center[a];
+        block.motion[a][slot] = motion[a];
+    }
+    block.start_time[slot] = start_time;
+    block.duration[slot] = duration;
+    block.radius_squared[slot] = r*r;
+    block.moving = block.moving || motion[0] != 0 || motion[1] != 0 || motion[2] != 0;
+
+    uint32_t id = 0;
+    while (id < materials.size() && materials[id] != m)
+        id++;
+    if (id == materials.size())
+        materials.push_back(m);
+
+    box = radius.empty() ? bounds : surrounding_box(box, bounds);
+    radius.push_back(r);
+    material_id.push_back(id);
+}
+
+
+point3 sphere_set::center(size_t i, double time) const {
+    const auto& block = blocks[i / block_size];
+    auto slot = i % block_size;
+    auto s = (time - block.start_time[slot]) / block.duration[slot];
+    return point3(block.center[0][slot] + s*block.motion[0][slot],
+                  block.center[1][slot] + s*block.motion[1][slot],
+                  block.center[2][slot] + s*block.motion[2][slot]);
+}
+
+
+#if defined(__AVX__)
+
+unsigned sphere_set::hit_block(
+    const sphere_block& block, const ray& r, double t_min, double t_max,
+    double roots[block_size]
+) const {
+    // All four spheres at once, through to the roots. The range tests are the unordered
+    // negations of those in sphere::hit(), so that NaNs come out the same way.
+    auto s = _mm256_setzero_pd();
+    if (block.moving)
+        s = _mm256_div_pd(_mm256_sub_pd(_mm256_set1_pd(r.time()),
+                                        _mm256_loadu_pd(block.start_time)),
+                          _mm256_loadu_pd(block.duration));
+
+    __m256d oc[3], d[3];
+    for (int a = 0; a < 3; a++) {
+        auto center = _mm256_add_pd(_mm256_loadu_pd(block.center[a]),
+                                    _mm256_mul_pd(s, _mm256_loadu_pd(block.motion[a])));
+        oc[a] = _mm256_sub_pd(_mm256_set1_pd(r.orig.e[a]), center);
+        d[a] = _mm256_set1_pd(r.dir.e[a]);
+    }
+
+    auto a = _mm256_set1_pd(r.dir.length_squared());
+    auto half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], d[0]),
+                                              _mm256_mul_pd(oc[1], d[1])),
+                                _mm256_mul_pd(oc[2], d[2]));
+    auto oc_squared = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(oc[0], oc[0]),
+                                                  _mm256_mul_pd(oc[1], oc[1])),
+                                    _mm256_mul_pd(oc[2], oc[2]));
+    auto c = _mm256_sub_pd(oc_squared, _mm256_loadu_pd(block.radius_squared));
+
+    auto zero = _mm256_setzero_pd();
+    auto discriminant = _mm256_sub_pd(_mm256_mul_pd(half_b, half_b), _mm256_mul_pd(a, c));
+    auto real_roots = _mm256_cmp_pd(discriminant, zero, _CMP_GE_OQ);
+    if (!_mm256_movemask_pd(real_roots))
+        return 0;
+
+    auto sqrtd = _mm256_sqrt_pd(_mm256_max_pd(discriminant, zero));
+
+    auto minus_half_b = _mm256_xor_pd(half_b, _mm256_set1_pd(-0.0));
+    auto near_root = _mm256_div_pd(_mm256_sub_pd(minus_half_b, sqrtd), a);
+    auto far_root  = _mm256_div_pd(_mm256_add_pd(minus_half_b, sqrtd), a);
+
+    auto lower = _mm256_set1_pd(t_min);
+    auto upper = _mm256_set1_pd(t_max);
+    auto near_ok = _mm256_and_pd(_mm256_cmp_pd(near_root, lower, _CMP_NLT_UQ),
+                                 _mm256_cmp_pd(upper, near_root, _CMP_NLT_UQ));
+    auto far_ok  = _mm256_and_pd(_mm256_cmp_pd(far_root, lower, _CMP_NLT_UQ),
+                                 _mm256_cmp_pd(upper, far_root, _CMP_NLT_UQ));
+
+    _mm256_storeu_pd(roots, _mm256_blendv_pd(far_root, near_root, near_ok));
+    auto found = _mm256_and_pd(real_roots, _mm256_or_pd(near_ok, far_ok));
+    return static_cast<unsigned>(_mm256_movemask_pd(found));
+}
+
+#else
+
+unsigned sphere_set::hit_block(
+    const sphere_block& block, const ray& r, double t_min, double t_max,
+    double roots[block_size]
+) const {
+    // The same arithmetic as sphere::hit(). The discriminants are found in a loop the compiler
+    // vectorizes; most blocks miss the ray outright, and the few spheres that do not are
+    // finished one at a time.
+    auto a = r.dir.length_squared();
+    double s[block_size] = {};
+    double half_b[block_size];
+    double discriminant[block_size];
+
+    if (block.moving)
+        for (int i = 0; i < block_size; i++)
+            s[i] = (r.time() - block.start_time[i]) / block.duration[i];
+
+    for (int i = 0; i < block_size; i++) {
+        auto ocx = r.orig.e[0] - (block.center[0][i] + s[i]*block.motion[0][i]);
+        auto ocy = r.orig.e[1] - (block.center[1][i] + s[i]*block.motion[1][i]);
+        auto ocz = r.orig.e[2] - (block.center[2][i] + s[i]*block.motion[2][i]);
+
+        half_b[i] = ocx*r.dir.e[0] + ocy*r.dir.e[1] + ocz*r.dir.e[2];
+        auto c = (ocx*ocx + ocy*ocy + ocz*ocz) - block.radius_squared[i];
+        discriminant[i] = half_b[i]*half_b[i] - a*c;
+    }
+
+    unsigned mask = 0;
+    for (int i = 0; i < block_size; i++) {
+        if (!(discriminant[i] >= 0))
+            continue;
+
+        auto sqrtd = sqrt(discriminant[i]);
+        auto root = (-half_b[i] - sqrtd) / a;
+        if (root < t_min || t_max < root) {
+            root = (-half_b[i] + sqrtd) / a;
+            if (root < t_min || t_max < root)
+                continue;
+        }
+
+        roots[i] = root;
+        mask |= 1u << i;
+    }
+    return mask;
+}
+
+#endif
+
+
+bool sphere_set::hit_closest(
+    const ray& r, double t_min, double t_max, hit_query& query
+) const {
+    // Every sphere of a block is tested against the closest hit found before the block, and the
+    // nearest of the block's hits wins, which finds the same hit as testing them one by one.
+    auto closest_so_far = t_max;
+    size_t closest = size();
+
+    for (size_t b = 0; b < blocks.size(); b++) {
+        double roots[block_size];
+        auto mask = hit_block(blocks[b], r, t_min, closest_so_far, roots);
+        for (int i = 0; mask; i++, mask >>= 1) {
+            if ((mask & 1) && !(closest_so_far < roots[i])) {
+                closest_so_far = roots[i];
+                closest = b*block_size + i;
+            }
+        }
+    }
+
+    if (closest == size())
+        return false;
+
+    query.t = closest_so_far;
+    query.object = this;
+    query.index = closest;
+    return true;
+}
+
+
+bool sphere_set::occluded(const ray& r, double t_min, double t_max) const {
+    double roots[block_size];
+    for (const auto& block : blocks)
+        if (hit_block(block, r, t_min, t_max, roots))
+            return true;
+
+    return false;
+}
+
+
+void sphere_set::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto center_now = center(query.index, r.time());
+    rec.t = query.t;
+    rec.p = r.at(rec.t);
+    vec3 outward_normal = (rec.p - center_now) / radius[query.index];
+    rec.set_face_normal(r, outward_normal);
+    get_sphere_uv(outward_normal, rec.u, rec.v);
+    rec.mat_ptr = materials[material_id[query.index]].get();
+}
+
+
+// Building BVH Leaves
+
+hittable_list pack_sphere_sets(
+    const hittable_list& list, double time0, double time1, int max_set_size = 16,
+    double sphere_cost = 0.5
+) {
+    // Returns the objects of list with its spheres and moving spheres gathered into sets, to
+    // build a BVH over. The sets are the leaves of a binary BVH whose surface area heuristic
+    // prices a sphere in a set at sphere_cost, relative to a sphere on its own, so spheres are
+    // only gathered where their boxes overlap enough that testing them together pays; leaves
+    // with anything but spheres keep their objects as they are.
+    hittable_list packed;
+    if (list.objects.empty())
+        return packed;
+
+    bvh_builder builder(list.objects, 0, list.objects.size(), time0, time1, bvh_split::sah,
+                        max_set_size, sphere_cost);
+
+    for (const auto& node : builder.nodes) {
+        if (node.count == 0)
+            continue;
+
+        auto set = make_shared<sphere_set>();
+        bool all_spheres = node.count > 1;
+        for (size_t i = 0; i < node.count && all_spheres; i++)
+            all_spheres = set->add(list.objects[builder.order[node.offset + i]]);
+
+        if (all_spheres) {
+            packed.add(set);
+        } else {
+            for (size_t i = 0; i < node.count; i++)
+                packed.add(list.objects[builder.order[node.offset + i]]);
+        }
+    }
+
+    return packed;
+}
+
+
+#endif
@@ -26,6 +26,16 @@ class xy_rect : public hittable {
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Z
             // dimension a small amount.
@@ -36,6 +46,7 @@ class xy_rect : public hittable {
     public:
         shared_ptr<material> mp;
         double x0, x1, y0, y1, k;
+        bool flipped = false;  // Swaps the front and back faces, as flip_face does
 };
 
 class xz_rect : public hittable {
@@ -48,6 +59,16 @@ class xz_rect : public hittable {
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the Y
             // dimension a small amount.
@@ -56,25 +77,29 @@ class xz_rect : public hittable {
         }
 
         virtual double pdf_value(const point3& origin, const vec3& v) const override {
-            hit_record rec;
-            if (!this->hit(ray(origin, v), 0.001, infinity, rec))
+            // Only the distance to the light is needed, and the normal is always along y.
+            hit_query query;
+            if (!hit_closest(ray(origin, v), 0.001, infinity, query))
                 return 0;
 
             auto area = (x1-x0)*(z1-z0);
-            auto distance_squared = rec.t * rec.t * v.length_squared();
-            auto cosine = fabs(dot(v, rec.normal) / v.length());
+            auto distance_squared = query.t * query.t * v.length_squared();
+            auto cosine = fabs(v.y() / v.length());
 
             return distance_squared / (cosine * area);
         }
 
         virtual vec3 random(const point3& origin) const override {
-            auto random_point = point3(random_double(x0,x1), k, random_double(z0,z1));
+            double u, v;
+            random_double_pair(u, v);
+            auto random_point = point3(x0 + u*(x1-x0), k, z0 + v*(z1-z0));
             return random_point - origin;
         }
 
     public:
         shared_ptr<material> mp;
         double x0, x1, z0, z1, k;
+        bool flipped = false;  // Swaps the front and back faces, as flip_face does
 };
 
 class yz_rect : public hittable {
@@ -87,6 +112,16 @@ class yz_rect : public hittable {
 
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             // The bounding box must have non-zero width in each dimension, so pad the X
             // dimension a small amount.
@@ -97,9 +132,14 @@ class yz_rect : public hittable {
     public:
         shared_ptr<material> mp;
         double y0, y1, z0, z1, k;
+        bool flipped = false;  // Swaps the front and back faces, as flip_face does
 };
 
 bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    return hit_in_two_phases(r, t_min, t_max, rec);
+}
+
+bool xy_rect::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
     auto t = (k-r.origin().z()) / r.direction().z();
     if (t < t_min || t > t_max)
         return false;
@@ -109,18 +149,63 @@ bool xy_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     if (x < x0 || x > x1 || y < y0 || y > y1)
         return false;
 
+    query.t = t;
+    query.object = this;
+    query.index = 0;
+    return true;
+}
+
+void xy_rect::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto t = query.t;
+    auto x = r.origin().x() + t*r.direction().x();
+    auto y = r.origin().y() + t*r.direction().y();
+
     rec.u = (x-x0)/(x1-x0);
     rec.v = (y-y0)/(y1-y0);
     rec.t = t;
     auto outward_normal = vec3(0, 0, 1);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    if (flipped)
+        rec.front_face = !rec.front_face;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
+}
 
-    return true;
+unsigned xy_rect::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // Runs the test of hit() across each group of lanes at once, then builds records for the
+    // lanes that hit, and only those, with hit() itself.
+    bool found[ray_packet::max_size];
+    for (int g = 0; g < rays.size; g += ray_packet::group_size) {
+        if (!lane_group_mask(lanes, g))
+            continue;
+
+        for (int i = g; i < g + ray_packet::group_size; i++) {
+            auto t = (k-rays.origin[2][i]) / rays.direction[2][i];
+            auto x = rays.origin[0][i] + t*rays.direction[0][i];
+            auto y = rays.origin[1][i] + t*rays.direction[1][i];
+            found[i] = !(t < t_min || t > t_max[i]) && !(x < x0 || x > x1 || y < y0 || y > y1);
+        }
+    }
+
+    unsigned hits = 0;
+    for (int i = 0; i < rays.size; i++) {
+        if ((lanes >> i) & 1 && found[i] && hit(rays.get(i), t_min, t_max[i], rec[i])) {
+            t_max[i] = rec[i].t;
+            hits |= 1u << i;
+        }
+    }
+    return hits;
 }
 
 bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    return hit_in_two_phases(r, t_min, t_max, rec);
+}
+
+bool xz_rect::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
     auto t = (k-r.origin().y()) / r.direction().y();
     if (t < t_min || t > t_max)
         return false;
@@ -130,18 +215,63 @@ bool xz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     if (x < x0 || x > x1 || z < z0 || z > z1)
         return false;
 
+    query.t = t;
+    query.object = this;
+    query.index = 0;
+    return true;
+}
+
+void xz_rect::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto t = query.t;
+    auto x = r.origin().x() + t*r.direction().x();
+    auto z = r.origin().z() + t*r.direction().z();
+
     rec.u = (x-x0)/(x1-x0);
     rec.v = (z-z0)/(z1-z0);
     rec.t = t;
     auto outward_normal = vec3(0, 1, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    if (flipped)
+        rec.front_face = !rec.front_face;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
+}
 
-    return true;
+unsigned xz_rect::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // Runs the test of hit() across each group of lanes at once, then builds records for the
+    // lanes that hit, and only those, with hit() itself.
+    bool found[ray_packet::max_size];
+    for (int g = 0; g < rays.size; g += ray_packet::group_size) {
+        if (!lane_group_mask(lanes, g))
+            continue;
+
+        for (int i = g; i < g + ray_packet::group_size; i++) {
+            auto t = (k-rays.origin[1][i]) / rays.direction[1][i];
+            auto x = rays.origin[0][i] + t*rays.direction[0][i];
+            auto z = rays.origin[2][i] + t*rays.direction[2][i];
+            found[i] = !(t < t_min || t > t_max[i]) && !(x < x0 || x > x1 || z < z0 || z > z1);
+        }
+    }
+
+    unsigned hits = 0;
+    for (int i = 0; i < rays.size; i++) {
+        if ((lanes >> i) & 1 && found[i] && hit(rays.get(i), t_min, t_max[i], rec[i])) {
+            t_max[i] = rec[i].t;
+            hits |= 1u << i;
+        }
+    }
+    return hits;
 }
 
 bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    return hit_in_two_phases(r, t_min, t_max, rec);
+}
+
+bool yz_rect::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
     auto t = (k-r.origin().x()) / r.direction().x();
     if (t < t_min || t > t_max)
         return false;
@@ -151,15 +281,56 @@ bool yz_rect::hit(const ray& r, double t_min, double t_max, hit_record& rec) con
     if (y < y0 || y > y1 || z < z0 || z > z1)
         return false;
 
+    query.t = t;
+    query.object = this;
+    query.index = 0;
+    return true;
+}
+
+void yz_rect::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto t = query.t;
+    auto y = r.origin().y() + t*r.direction().y();
+    auto z = r.origin().z() + t*r.direction().z();
+
     rec.u = (y-y0)/(y1-y0);
     rec.v = (z-z0)/(z1-z0);
     rec.t = t;
     auto outward_normal = vec3(1, 0, 0);
     rec.set_face_normal(r, outward_normal);
-    rec.mat_ptr = mp;
+    if (flipped)
+        rec.front_face = !rec.front_face;
+    rec.mat_ptr = mp.get();
     rec.p = r.at(t);
+}
 
-    return true;
+unsigned yz_rect::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // Runs the test of hit() across each group of lanes at once, then builds records for the
+    // lanes that hit, and only those, with hit() itself.
+    bool found[ray_packet::max_size];
+    for (int g = 0; g < rays.size; g += ray_packet::group_size) {
+        if (!lane_group_mask(lanes, g))
+            continue;
+
+        for (int i = g; i < g + ray_packet::group_size; i++) {
+            auto t = (k-rays.origin[0][i]) / rays.direction[0][i];
+            auto y = rays.origin[1][i] + t*rays.direction[1][i];
+            auto z = rays.origin[2][i] + t*rays.direction[2][i];
+            found[i] = !(t < t_min || t > t_max[i]) && !(y < y0 || y > y1 || z < z0 || z > z1);
+        }
+    }
+
+    unsigned hits = 0;
+    for (int i = 0; i < rays.size; i++) {
+        if ((lanes >> i) & 1 && found[i] && hit(rays.get(i), t_min, t_max[i], rec[i])) {
+            t_max[i] = rec[i].t;
+            hits |= 1u << i;
+        }
+    }
+    return hits;
 }
 
 #endif
@@ -13,16 +13,42 @@
 
 #include "rtweekend.h"
 
-#include "aarect.h"
-#include "hittable_list.h"
+#include "hittable.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 
 
 class box : public hittable  {
+    // An axis-aligned box, intersected directly rather than as a list of six rectangles. The
+    // faces are tested in the order the rectangles were listed, with the same arithmetic, so
+    // the same face wins every hit, edges and ties included, and the record matches too: the
+    // normal and UV of a face come from its axis, as an xy_rect, xz_rect or yz_rect would give.
     public:
         box() {}
-        box(const point3& p0, const point3& p1, shared_ptr<material> ptr);
+        box(const point3& p0, const point3& p1, shared_ptr<material> ptr)
+            : box_min(p0), box_max(p1), mp(ptr) {}
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
 
-        virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const override;
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            double t[6];
+            return face_hits(r, t_min, t_max, t) != 0;
+        }
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
 
         virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
             output_box = aabb(box_min, box_max);
@@ -32,26 +58,168 @@ class box : public hittable  {
     public:
         point3 box_min;
         point3 box_max;
-        hittable_list sides;
+        shared_ptr<material> mp;
+
+    private:
+        // Face f lies in a plane normal to axis 2 - f/2, so z, y, then x, at box_max for even f
+        // and box_min for odd f. Its other two axes, in UV order, are face_u and face_v.
+        static int face_axis(int f) { return 2 - f/2; }
+        static int face_u(int axis) { return axis == 0 ? 1 : 0; }
+        static int face_v(int axis) { return axis == 2 ? 1 : 2; }
+
+        // Returns the mask of the faces that the ray crosses within [t_min, t_max], and writes
+        // the distance to each face's plane.
+        unsigned face_hits(const ray& r, double t_min, double t_max, double t[6]) const;
 };
 
 
-box::box(const point3& p0, const point3& p1, shared_ptr<material> ptr) {
-    box_min = p0;
-    box_max = p1;
+unsigned box::face_hits(const ray& r, double t_min, double t_max, double t[6]) const {
+    // A ray that reaches a box could cross any of its faces, so the faces are tested without
+    // branches: the two normal to each axis together.
+    unsigned mask = 0;
+
+#if defined(__SSE__) || defined(_M_X64)
+    for (int f = 0; f < 6; f += 2) {
+        auto a = face_axis(f);
+        auto b = face_u(a);
+        auto c = face_v(a);
+
+        auto k = _mm_set_pd(box_min.e[a], box_max.e[a]);
+        auto t_face = _mm_div_pd(_mm_sub_pd(k, _mm_set1_pd(r.orig.e[a])),
+                                 _mm_set1_pd(r.dir.e[a]));
+        auto u = _mm_add_pd(_mm_set1_pd(r.orig.e[b]), _mm_mul_pd(t_face, _mm_set1_pd(r.dir.e[b])));
+        auto v = _mm_add_pd(_mm_set1_pd(r.orig.e[c]), _mm_mul_pd(t_face, _mm_set1_pd(r.dir.e[c])));
+
+        // The not-less and not-greater comparisons are true for NaNs, as the rectangle tests'
+        // negated ones are.
+        auto in_range = _mm_and_pd(_mm_cmpnlt_pd(t_face, _mm_set1_pd(t_min)),
+                                   _mm_cmpngt_pd(t_face, _mm_set1_pd(t_max)));
+        auto in_u = _mm_and_pd(_mm_cmpnlt_pd(u, _mm_set1_pd(box_min.e[b])),
+                               _mm_cmpngt_pd(u, _mm_set1_pd(box_max.e[b])));
+        auto in_v = _mm_and_pd(_mm_cmpnlt_pd(v, _mm_set1_pd(box_min.e[c])),
+                               _mm_cmpngt_pd(v, _mm_set1_pd(box_max.e[c])));
+
+        _mm_storeu_pd(t + f, t_face);
+        auto found = _mm_and_pd(in_range, _mm_and_pd(in_u, in_v));
+        mask |= static_cast<unsigned>(_mm_movemask_pd(found)) << f;
+    }
+#else
+    for (int f = 0; f < 6; f++) {
+        auto a = face_axis(f);
+        auto b = face_u(a);
+        auto c = face_v(a);
+
+        auto k = (f % 2 == 0) ? box_max.e[a] : box_min.e[a];
+        t[f] = (k-r.orig.e[a]) / r.dir.e[a];
+        auto u = r.orig.e[b] + t[f]*r.dir.e[b];
+        auto v = r.orig.e[c] + t[f]*r.dir.e[c];
+
+        bool found = !(t[f] < t_min) & !(t[f] > t_max)
+                   & !(u < box_min.e[b]) & !(u > box_max.e[b])
+                   & !(v < box_min.e[c]) & !(v > box_max.e[c]);
+        mask |= static_cast<unsigned>(found) << f;
+    }
+#endif
+
+    return mask;
+}
 
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), ptr));
-    sides.add(make_shared<xy_rect>(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), ptr));
 
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), ptr));
-    sides.add(make_shared<xz_rect>(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), ptr));
+bool box::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    // The nearest face crossed wins, with a later face winning a tie, as a later object does in
+    // hittable_list.
+    double t[6];
+    auto mask = face_hits(r, t_min, t_max, t);
+    if (!mask)
+        return false;
 
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), ptr));
-    sides.add(make_shared<yz_rect>(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), ptr));
+    int face = -1;
+    for (int f = 0; f < 6; f++) {
+        if ((mask >> f) & 1 && !(t[f] > t_max)) {
+            t_max = t[f];
+            face = f;
+        }
+    }
+
+    query.t = t_max;
+    query.object = this;
+    query.index = face;
+    return true;
 }
 
-bool box::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
-    return sides.hit(r, t_min, t_max, rec);
+
+unsigned box::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // Runs the face tests and the choice of face of hit_closest() across each group of lanes
+    // at once, face by face, then builds records for the lanes that hit, and only those.
+    double nearest[ray_packet::max_size];
+    int face[ray_packet::max_size];
+    for (int g = 0; g < rays.size; g += ray_packet::group_size) {
+        if (!lane_group_mask(lanes, g))
+            continue;
+
+        for (int i = g; i < g + ray_packet::group_size; i++) {
+            nearest[i] = t_max[i];
+            face[i] = -1;
+        }
+
+        for (int f = 0; f < 6; f++) {
+            auto a = face_axis(f);
+            auto b = face_u(a);
+            auto c = face_v(a);
+            auto k = (f % 2 == 0) ? box_max.e[a] : box_min.e[a];
+
+            for (int i = g; i < g + ray_packet::group_size; i++) {
+                auto t = (k-rays.origin[a][i]) / rays.direction[a][i];
+                auto u = rays.origin[b][i] + t*rays.direction[b][i];
+                auto v = rays.origin[c][i] + t*rays.direction[c][i];
+
+                bool found = !(t < t_min) & !(t > t_max[i])
+                           & !(u < box_min.e[b]) & !(u > box_max.e[b])
+                           & !(v < box_min.e[c]) & !(v > box_max.e[c]);
+                bool nearer = found & !(t > nearest[i]);
+                nearest[i] = nearer ? t : nearest[i];
+                face[i] = nearer ? f : face[i];
+            }
+        }
+    }
+
+    unsigned hits = 0;
+    for (int i = 0; i < rays.size; i++) {
+        if (!((lanes >> i) & 1) || face[i] < 0)
+            continue;
+
+        hit_query query;
+        query.t = nearest[i];
+        query.object = this;
+        query.index = face[i];
+        compute_surface_interaction(rays.get(i), t_min, query, rec[i]);
+        t_max[i] = nearest[i];
+        hits |= 1u << i;
+    }
+    return hits;
+}
+
+
+void box::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto a = face_axis(static_cast<int>(query.index));
+    auto b = face_u(a);
+    auto c = face_v(a);
+    auto t = query.t;
+    auto u = r.orig.e[b] + t*r.dir.e[b];
+    auto v = r.orig.e[c] + t*r.dir.e[c];
+
+    rec.u = (u-box_min.e[b])/(box_max.e[b]-box_min.e[b]);
+    rec.v = (v-box_min.e[c])/(box_max.e[c]-box_min.e[c]);
+    rec.t = t;
+    vec3 outward_normal(0, 0, 0);
+    outward_normal.e[a] = 1;
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = mp.get();
+    rec.p = r.at(t);
 }
 
 
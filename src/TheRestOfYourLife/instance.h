@@ -0,0 +1,259 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+
+
+struct affine {
+    // The map p -> linear*p + offset from an object's own space into the world, along with the
+    // inverse of its linear part, so that neither direction needs a matrix inversion per ray.
+    // A rigid transform, made of only translations and rotations, keeps normals unit length.
+    double linear[3][3];
+    double inverse[3][3];
+    vec3 offset;
+    bool rigid;
+
+    static affine identity() {
+        affine a;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                a.linear[i][j] = a.inverse[i][j] = (i == j) ? 1 : 0;
+        a.offset = vec3(0,0,0);
+        a.rigid = true;
+        return a;
+    }
+
+    static affine translation(const vec3& displacement) {
+        auto a = identity();
+        a.offset = displacement;
+        return a;
+    }
+
+    // A rotation about the Y axis, by the angle whose sine and cosine are given, as rotate_y.
+    static affine rotation_y(double sin_theta, double cos_theta) {
+        auto a = identity();
+        a.linear[0][0] = a.inverse[0][0] = cos_theta;
+        a.linear[2][2] = a.inverse[2][2] = cos_theta;
+        a.linear[0][2] = a.inverse[2][0] = sin_theta;
+        a.linear[2][0] = a.inverse[0][2] = -sin_theta;
+        return a;
+    }
+
+    static affine rotation_y(double angle) {
+        auto radians = degrees_to_radians(angle);
+        return rotation_y(sin(radians), cos(radians));
+    }
+
+    // A rotation by angle degrees about the given axis, counterclockwise looking down the axis.
+    static affine rotation(const vec3& axis, double angle) {
+        auto radians = degrees_to_radians(angle);
+        auto s = sin(radians);
+        auto c = cos(radians);
+        auto u = unit_vector(axis);
+
+        // Rodrigues' formula; the inverse of a rotation is its transpose.
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                auto k = 3 - i - j;
+                auto cross_term = (i == j) ? 0 : ((j == (i+1) % 3) ? -s : s) * u[k];
+                a.linear[i][j] = a.inverse[j][i] = ((i == j) ? c : 0) + (1-c)*u[i]*u[j]
+                                                   + cross_term;
+            }
+        }
+        a.offset = vec3(0,0,0);
+        a.rigid = true;
+        return a;
+    }
+
+    static affine scaling(const vec3& factors) {
+        auto a = identity();
+        for (int i = 0; i < 3; i++) {
+            a.linear[i][i] = factors[i];
+            a.inverse[i][i] = 1 / factors[i];
+        }
+        a.rigid = false;
+        return a;
+    }
+
+    // This transform followed by outer.
+    affine then(const affine& outer) const {
+        affine a;
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                a.linear[i][j] = outer.linear[i][0]*linear[0][j] + outer.linear[i][1]*linear[1][j]
+                               + outer.linear[i][2]*linear[2][j];
+                a.inverse[i][j] = inverse[i][0]*outer.inverse[0][j]
+                                + inverse[i][1]*outer.inverse[1][j]
+                                + inverse[i][2]*outer.inverse[2][j];
+            }
+        }
+        a.offset = outer.apply(offset);
+        a.rigid = rigid && outer.rigid;
+        return a;
+    }
+
+    // Object space to world space.
+    point3 apply(const point3& p) const { return multiply(linear, p) + offset; }
+
+    // World space to object space, for points and for directions.
+    point3 unapply(const point3& p) const { return multiply(inverse, p - offset); }
+    vec3 unapply_vector(const vec3& v) const { return multiply(inverse, v); }
+
+    // An object space normal in world space: the inverse transpose keeps it normal to the
+    // surface under any linear map, and equals the rotation itself for a rotation.
+    vec3 apply_normal(const vec3& n) const {
+        vec3 normal(
+            inverse[0][0]*n[0] + inverse[1][0]*n[1] + inverse[2][0]*n[2],
+            inverse[0][1]*n[0] + inverse[1][1]*n[1] + inverse[2][1]*n[2],
+            inverse[0][2]*n[0] + inverse[1][2]*n[1] + inverse[2][2]*n[2]);
+        return rigid ? normal : unit_vector(normal);
+    }
+
+    static vec3 multiply(const double m[3][3], const vec3& v) {
+        return vec3(
+            m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+            m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+            m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]);
+    }
+};
+
+
+class instance : public hittable {
+    // An object placed in the world by one affine transform, which stands for a whole chain of
+    // translate and rotate_y wrappers: a ray is moved into the object's space by one matrix,
+    // and a hit is moved back by one more. The ray's direction is not renormalized, so hit
+    // distances are the same in both spaces.
+    //
+    // Many instances may share the same object, such as a BVH over a prop's primitives, which
+    // is then stored once however many times it appears. A BVH over the instances themselves
+    // (which compile_scene() builds for any long list) makes the two-level structure: the top
+    // level finds the instances a ray reaches, and each instance's bottom level BVH is traced
+    // in that instance's own space.
+    //
+    // The object's front face is kept. The wrappers instead turn the normal they are given,
+    // which already faces against the ray, so a hit through them always looks like a front
+    // face hit; the normal itself comes out the same.
+    public:
+        instance(shared_ptr<hittable> p, const affine& object_to_world)
+            : ptr(p), transform(object_to_world) {}
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override;
+
+        virtual void compute_surface_interaction(
+            const ray& r, double t_min, const hit_query& query, hit_record& rec) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(object_ray(r), t_min, t_max);
+        }
+
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override;
+
+    public:
+        shared_ptr<hittable> ptr;
+        affine transform;
+
+    private:
+        ray object_ray(const ray& r) const {
+            return ray(transform.unapply(r.origin()), transform.unapply_vector(r.direction()),
+                       r.time());
+        }
+
+        void world_record(const ray& r, hit_record& rec) const {
+            auto outward_normal = rec.front_face ? rec.normal : -rec.normal;
+            rec.p = transform.apply(rec.p);
+            rec.set_face_normal(r, transform.apply_normal(outward_normal));
+        }
+};
+
+
+bool instance::hit_closest(const ray& r, double t_min, double t_max, hit_query& query) const {
+    // The object hit in the instance's space is kept in the query, even within another
+    // instance, so that compute_surface_interaction() need not search for it again.
+    hit_query inner;
+    return ptr->hit_closest(object_ray(r), t_min, t_max, inner) && wrap_hit(inner, query);
+}
+
+
+void instance::compute_surface_interaction(
+    const ray& r, double t_min, const hit_query& query, hit_record& rec
+) const {
+    auto inner = wrapped_query(query);
+    inner.object->compute_surface_interaction(object_ray(r), t_min, inner, rec);
+    world_record(r, rec);
+}
+
+
+unsigned instance::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    ray_packet moved = rays;
+    for (int k = 0; k < rays.size; k++) {
+        auto local = object_ray(rays.get(k));
+        for (int a = 0; a < 3; a++) {
+            moved.origin[a][k] = local.orig.e[a];
+            moved.direction[a][k] = local.dir.e[a];
+        }
+        moved.prepare(k);
+    }
+
+    auto hits = ptr->hit_packet(moved, lanes, t_min, t_max, rec);
+    for (int k = 0; k < rays.size; k++)
+        if ((hits >> k) & 1)
+            world_record(rays.get(k), rec[k]);
+
+    return hits;
+}
+
+
+bool instance::bounding_box(double time0, double time1, aabb& output_box) const {
+    // The box around the eight corners of the object's box, moved into the world.
+    aabb object_box;
+    if (!ptr->bounding_box(time0, time1, object_box))
+        return false;
+
+    point3 min( infinity,  infinity,  infinity);
+    point3 max(-infinity, -infinity, -infinity);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                auto corner = transform.apply(point3(
+                    i ? object_box.max().x() : object_box.min().x(),
+                    j ? object_box.max().y() : object_box.min().y(),
+                    k ? object_box.max().z() : object_box.min().z()));
+
+                for (int c = 0; c < 3; c++) {
+                    min[c] = fmin(min[c], corner[c]);
+                    max[c] = fmax(max[c], corner[c]);
+                }
+            }
+        }
+    }
+
+    output_box = aabb(min, max);
+    return true;
+}
+
+
+#endif
@@ -17,48 +17,74 @@
 #include "color.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "render.h"
+#include "scene_compiler.h"
 #include "sphere.h"
 
 #include <iostream>
 
+#ifdef COUNT_HEAP_ALLOCATIONS
+#include "heap_counter.h"
+#endif
+
 
 color ray_color(
-    const ray& r,
+    ray r,
     const color& background,
     const hittable& world,
-    shared_ptr<hittable> lights,
-    int depth
+    const hittable& lights,
+    int max_depth,
+    const hit_record* primary = nullptr,
+    bool primary_hit = false
 ) {
-    hit_record rec;
+    // Follow the path one bounce at a time, adding the light emitted at each hit weighted by the
+    // path throughput: the product of each bounce's attenuation and scattering PDF, divided by
+    // the PDF the bounce direction was actually sampled from. If primary is given, the camera
+    // ray has already been traced, in a packet, and primary and primary_hit hold its result.
+    color radiance(0,0,0);
+    color throughput(1,1,1);
+
+    for (int bounce = 1; bounce <= max_depth; bounce++) {
+        // Each bounce draws its random numbers from its own dimensions of the sample stream.
+        set_sample_bounce(bounce);
+        thread_rays_traced()++;
+
+        // If the ray hits nothing, add the background color.
+        hit_record rec;
+        if (bounce == 1 && primary) {
+            if (!primary_hit)
+                return radiance + throughput * background;
+            rec = *primary;
+        } else if (!world.hit(r, 0.001, infinity, rec)) {
+            return radiance + throughput * background;
+        }
 
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
+        scatter_record srec;
+        radiance += throughput * rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
 
-    // If the ray hits nothing, return the background color.
-    if (!world.hit(r, 0.001, infinity, rec))
-        return background;
+        if (!rec.mat_ptr->scatter(r, rec, srec))
+            return radiance;
 
-    scatter_record srec;
-    color emitted = rec.mat_ptr->emitted(r, rec, rec.u, rec.v, rec.p);
+        if (srec.is_specular) {
+            throughput = throughput * srec.attenuation;
+            r = srec.specular_ray;
+        } else {
+            hittable_pdf light_pdf(lights, rec.p);
+            mixture_pdf p(light_pdf, *srec.pdf_ptr);
+            ray scattered = ray(rec.p, p.generate(), r.time());
+            auto pdf_val = p.value(scattered.direction());
 
-    if (!rec.mat_ptr->scatter(r, rec, srec))
-        return emitted;
+            throughput = throughput * srec.attenuation
+                       * rec.mat_ptr->scattering_pdf(r, rec, scattered) / pdf_val;
+            r = scattered;
+        }
 
-    if (srec.is_specular) {
-        return srec.attenuation
-             * ray_color(srec.specular_ray, background, world, lights, depth-1);
+        if (!survives_russian_roulette(throughput, bounce))
+            return radiance;
     }
 
-    auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-    mixture_pdf p(light_ptr, srec.pdf_ptr);
-    ray scattered = ray(rec.p, p.generate(), r.time());
-    auto pdf_val = p.value(scattered.direction());
-
-    return emitted
-         + srec.attenuation * rec.mat_ptr->scattering_pdf(r, rec, scattered)
-                            * ray_color(scattered, background, world, lights, depth-1)
-                            / pdf_val;
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    return radiance;
 }
 
 
@@ -90,7 +116,9 @@ hittable_list cornell_box() {
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
+    auto options = parse_render_options(argc, argv);
+
     // Image
 
     const auto aspect_ratio = 1.0 / 1.0;
@@ -105,7 +133,7 @@ int main() {
     lights->add(make_shared<xz_rect>(213, 343, 227, 332, 554, shared_ptr<material>()));
     lights->add(make_shared<sphere>(point3(190, 90, 190), 90, shared_ptr<material>()));
 
-    auto world = cornell_box();
+    auto world = compile_scene(cornell_box(), 0.0, 1.0, options.bvh_width);
 
     color background(0,0,0);
 
@@ -124,21 +152,33 @@ int main() {
 
     // Render
 
-    std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-
-    for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
-            color pixel_color(0,0,0);
-            for (int s = 0; s < samples_per_pixel; ++s) {
-                auto u = (i + random_double()) / (image_width-1);
-                auto v = (j + random_double()) / (image_height-1);
-                ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, background, world, lights, max_depth);
-            }
-            write_color(std::cout, pixel_color, samples_per_pixel);
-        }
-    }
+    tile_renderer renderer(image_width, image_height, samples_per_pixel, options);
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+    auto allocations_before = heap_allocation_count().load();
+#endif
+
+    renderer.render_packets<hit_record>(
+        [&](double u, double v) { return cam.get_ray(u, v); },
+        [&](const ray_packet& rays, unsigned lanes, hit_record* hits) {
+            double t_max[ray_packet::max_size];
+            std::fill(t_max, t_max + ray_packet::max_size, infinity);
+            return world.hit_packet(rays, lanes, 0.001, t_max, hits);
+        },
+        [&](const ray& r, const hit_record* primary, bool primary_hit) {
+            return ray_color(r, background, world, *lights, max_depth, primary, primary_hit);
+        });
+
+#ifdef COUNT_HEAP_ALLOCATIONS
+    // Shading should not touch the heap; the renderer itself makes a handful of allocations.
+    auto allocations = heap_allocation_count().load() - allocations_before;
+    auto samples = static_cast<double>(renderer.total_samples());
+    std::cerr << "\nHeap allocations while rendering: " << allocations
+              << " (" << allocations / samples << " per sample)\n";
+#endif
+
+    if (!renderer.write_image())
+        return 1;
 
     std::cerr << "\nDone.\n";
 }
@@ -16,12 +16,34 @@
 #include "pdf.h"
 #include "texture.h"
 
+#include <new>
+#include <type_traits>
+#include <utility>
+
 
 struct scatter_record {
+    scatter_record() : pdf_ptr(nullptr) {}
+    scatter_record(const scatter_record&) = delete;
+    scatter_record& operator=(const scatter_record&) = delete;
+
+    // Builds the material's sampling PDF in this record's own storage, so that scattering never
+    // touches the heap. The record lives on the stack for one bounce, and the PDF is simply
+    // abandoned with the record, so it must not own anything its destructor would release.
+    template <typename T, typename... Args>
+    void make_pdf(Args&&... args) {
+        static_assert(sizeof(T) <= sizeof(pdf_storage), "PDF too large for scatter_record");
+        static_assert(alignof(T) <= alignof(decltype(pdf_storage)),
+                      "PDF too strictly aligned for scatter_record");
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "PDF in a scatter_record must be trivially destructible");
+        pdf_ptr = new (static_cast<void*>(&pdf_storage)) T(std::forward<Args>(args)...);
+    }
+
     ray specular_ray;
     bool is_specular;
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    const pdf* pdf_ptr;  // Points into pdf_storage, or null for specular scattering
+    std::aligned_storage<128, alignof(double)>::type pdf_storage;
 };
 
 
@@ -57,7 +79,7 @@ class lambertian : public material {
         ) const override {
             srec.is_specular = false;
             srec.attenuation = albedo->value(rec.u, rec.v, rec.p);
-            srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+            srec.make_pdf<cosine_pdf>(rec.normal);
             return true;
         }
 
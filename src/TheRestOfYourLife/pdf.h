@@ -17,8 +17,8 @@
 
 
 inline vec3 random_cosine_direction() {
-    auto r1 = random_double();
-    auto r2 = random_double();
+    double r1, r2;
+    random_double_pair(r1, r2);
     auto z = sqrt(1-r2);
 
     auto phi = 2*pi*r1;
@@ -30,8 +30,8 @@ inline vec3 random_cosine_direction() {
 
 
 inline vec3 random_to_sphere(double radius, double distance_squared) {
-    auto r1 = random_double();
-    auto r2 = random_double();
+    double r1, r2;
+    random_double_pair(r1, r2);
     auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
 
     auto phi = 2*pi*r1;
@@ -44,10 +44,13 @@ inline vec3 random_to_sphere(double radius, double distance_squared) {
 
 class pdf  {
     public:
-        virtual ~pdf() {}
-
         virtual double value(const vec3& direction) const = 0;
         virtual vec3 generate() const = 0;
+
+    protected:
+        // PDFs are never deleted through a pdf pointer, so the destructor need not be virtual,
+        // and leaving it trivial lets a scatter_record abandon the PDF it holds.
+        ~pdf() = default;
 };
 
 
@@ -69,9 +72,12 @@ class cosine_pdf : public pdf {
 };
 
 
+// The PDFs below are value types that refer to, but do not own, the objects they sample. They
+// are built on the stack for each bounce, so shading makes no heap allocations.
+
 class hittable_pdf : public pdf {
     public:
-        hittable_pdf(shared_ptr<hittable> p, const point3& origin) : ptr(p), o(origin) {}
+        hittable_pdf(const hittable& p, const point3& origin) : o(origin), ptr(&p) {}
 
         virtual double value(const vec3& direction) const override {
             return ptr->pdf_value(o, direction);
@@ -83,15 +89,15 @@ class hittable_pdf : public pdf {
 
     public:
         point3 o;
-        shared_ptr<hittable> ptr;
+        const hittable* ptr;
 };
 
 
 class mixture_pdf : public pdf {
     public:
-        mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-            p[0] = p0;
-            p[1] = p1;
+        mixture_pdf(const pdf& p0, const pdf& p1) {
+            p[0] = &p0;
+            p[1] = &p1;
         }
 
         virtual double value(const vec3& direction) const override {
@@ -106,7 +112,7 @@ class mixture_pdf : public pdf {
         }
 
     public:
-        shared_ptr<pdf> p[2];
+        const pdf* p[2];
 };
 
 
@@ -0,0 +1,463 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "bvh_build.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+template <int N>
+struct wide_bvh_node {
+    // A node with up to N children, whose boxes are stored by axis so that one SIMD test covers
+    // all of them. A child is either another node or a leaf holding a run of primitives. The
+    // node is padded to a whole number of 64-byte cache lines.
+    aabb_pack<float, N> boxes;  // Child bounds, rounded outward
+    uint32_t child[N];          // Interior child: node index. Leaf child: first primitive index.
+    uint8_t count[N];           // Primitives in a leaf child, zero for an interior child
+    uint8_t child_mask;         // Bit i is set if child i exists
+    uint8_t pad[63 - (29*N) % 64];
+};
+
+
+template <int N>
+class wide_bvh : public hittable {
+    // A BVH with N children per node (a QBVH for N = 4), made by collapsing the binary tree of
+    // bvh_builder: each node absorbs the children of its largest interior child until it has N.
+    public:
+        wide_bvh(
+            const hittable_list& list, double time0, double time1,
+            bvh_split split = bvh_split::sah);
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override {
+            return hit_in_two_phases(r, t_min, t_max, rec);
+        }
+
+        virtual bool hit_closest(
+            const ray& r, double t_min, double t_max, hit_query& query) const override {
+            return traverse<false, false>(r, t_min, t_max, query, nullptr);
+        }
+
+        // Stops at the first primitive hit, in whatever order the traversal reaches it.
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            hit_query query;
+            return traverse<false, true>(r, t_min, t_max, query, nullptr);
+        }
+
+        // Traces the packet's lanes together: each node's child boxes are tested against every
+        // lane, and a child is visited with the lanes that enter it.
+        virtual unsigned hit_packet(
+            const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+        ) const override;
+
+        // Like hit(), but also counts the work done into counts.
+        bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec,
+            traversal_stats& counts) const {
+            hit_query query;
+            if (!traverse<true, false>(r, t_min, t_max, query, &counts))
+                return false;
+            query.object->compute_surface_interaction(r, t_min, query, rec);
+            return true;
+        }
+
+        virtual bool bounding_box(double time0, double time1, aabb& output_box) const override {
+            output_box = box;
+            return true;
+        }
+
+        bvh_stats stats() const;
+
+        size_t node_count() const { return count; }
+        const wide_bvh_node<N>& node(size_t i) const { return nodes[i]; }
+
+    public:
+        std::vector<shared_ptr<hittable>> objects;  // Owned primitives, in leaf order
+        aabb box;
+
+    private:
+        static const int max_leaf_primitives = 4;
+        static const int stack_size_limit = 64 * (N-1) + 1;  // For trees up to 64 levels deep
+
+        std::unique_ptr<unsigned char[]> storage;
+        wide_bvh_node<N>* nodes;          // Cache-line aligned view of storage
+        size_t count;
+        std::vector<const hittable*> primitives;  // Non-owning copies of objects, for traversal
+
+        // Finds the closest hit, or with AnyHit, whether there is any hit at all.
+        template <bool Count, bool AnyHit>
+        bool traverse(
+            const ray& r, double t_min, double t_max, hit_query& query,
+            traversal_stats* counts) const {
+            return traverse_nodes<Count, AnyHit>(
+                nodes, r, t_min, t_max,
+                [&](uint32_t i, double t_limit, double& t_hit) -> bool {
+                    if (AnyHit)
+                        return primitives[i]->occluded(r, t_min, t_limit);
+                    if (!primitives[i]->hit_closest(r, t_min, t_limit, query))
+                        return false;
+                    t_hit = query.t;
+                    return true;
+                },
+                counts);
+        }
+
+    public:
+        // The node building and traversal of the BVH, for structures that keep their
+        // primitives in some other way, such as compiled_scene.
+
+        // Appends the nodes of the subtree at the given node of a finished build to out, and
+        // returns the index of its root.
+        static uint32_t collapse(
+            const bvh_builder& builder, size_t index, std::vector<wide_bvh_node<N>>& out);
+
+        // Traverses nodes, calling test_primitive(i, t_limit, t_hit) on the primitives in leaf
+        // slot i of the leaves the ray reaches. It returns whether the primitive is hit within
+        // [t_min, t_limit], and if so, sets t_hit to the distance, which AnyHit need not do.
+        template <bool Count, bool AnyHit, typename PrimitiveTest>
+        static bool traverse_nodes(
+            const wide_bvh_node<N>* nodes, const ray& r, double t_min, double t_max,
+            const PrimitiveTest& test_primitive, traversal_stats* counts);
+};
+
+
+template <int N>
+wide_bvh<N>::wide_bvh(
+    const hittable_list& list, double time0, double time1, bvh_split split
+) : nodes(nullptr), count(0) {
+    static_assert(sizeof(wide_bvh_node<N>) % 64 == 0, "wide_bvh_node must fill cache lines");
+
+    auto leaf_limit = (split == bvh_split::sah) ? max_leaf_primitives : 2;
+    bvh_builder builder(list.objects, 0, list.objects.size(), time0, time1, split, leaf_limit);
+
+    objects.reserve(builder.order.size());
+    for (auto index : builder.order)
+        objects.push_back(list.objects[index]);
+    for (const auto& object : objects)
+        primitives.push_back(object.get());
+
+    std::vector<wide_bvh_node<N>> built;
+    if (builder.nodes.empty()) {
+        built.push_back(wide_bvh_node<N>());
+        built[0].child_mask = 0;
+    } else {
+        built.reserve(builder.nodes.size() / (N-1) + 1);
+        collapse(builder, 0, built);
+    }
+
+    // Copy the nodes into storage aligned to a 64-byte cache line.
+    count = built.size();
+    void* aligned_start;
+    size_t space = count * sizeof(wide_bvh_node<N>) + 64;
+    storage.reset(new unsigned char[space]);
+    aligned_start = storage.get();
+    nodes = static_cast<wide_bvh_node<N>*>(
+        std::align(64, count * sizeof(wide_bvh_node<N>), aligned_start, space));
+    std::copy(built.begin(), built.end(), nodes);
+
+    box = builder.nodes.empty() ? aabb() : builder.nodes[0].box;
+}
+
+
+template <int N>
+uint32_t wide_bvh<N>::collapse(
+    const bvh_builder& builder, size_t index, std::vector<wide_bvh_node<N>>& out
+) {
+    // Gathers up to N descendants of a binary node, always opening the interior child with the
+    // largest surface area, since it is the one most likely to be hit. Then appends the node and
+    // collapses each interior child in turn. Returns the index of the node.
+    size_t children[N];
+    int child_count = 0;
+
+    const auto& root = builder.nodes[index];
+    if (root.count > 0) {
+        children[child_count++] = index;
+    } else {
+        children[child_count++] = index + 1;
+        children[child_count++] = root.offset;
+    }
+
+    while (child_count < N) {
+        int largest = -1;
+        auto largest_area = -infinity;
+        for (int i = 0; i < child_count; i++) {
+            const auto& node = builder.nodes[children[i]];
+            if (node.count == 0 && node.box.area() > largest_area) {
+                largest = i;
+                largest_area = node.box.area();
+            }
+        }
+
+        if (largest < 0)
+            break;
+
+        auto opened = children[largest];
+        children[largest] = opened + 1;
+        children[child_count++] = builder.nodes[opened].offset;
+    }
+
+    auto node_index = static_cast<uint32_t>(out.size());
+    out.push_back(wide_bvh_node<N>());
+
+    for (int i = 0; i < N; i++) {
+        if (i >= child_count) {
+            out[node_index].boxes.set(i, aabb(point3(0,0,0), point3(0,0,0)));
+            out[node_index].child[i] = 0;
+            out[node_index].count[i] = 0;
+            continue;
+        }
+
+        const auto& built = builder.nodes[children[i]];
+        for (int a = 0; a < 3; a++) {
+            out[node_index].boxes.lower[a][i] = round_down(built.box.min()[a]);
+            out[node_index].boxes.upper[a][i] = round_up(built.box.max()[a]);
+        }
+
+        // Appending may reallocate out, so only index into it after the child is collapsed.
+        auto child = (built.count > 0) ? static_cast<uint32_t>(built.offset)
+                                       : collapse(builder, children[i], out);
+        out[node_index].child[i] = child;
+        out[node_index].count[i] = static_cast<uint8_t>(built.count);
+    }
+
+    out[node_index].child_mask = static_cast<uint8_t>((1u << child_count) - 1);
+    return node_index;
+}
+
+
+template <int N>
+template <bool Count, bool AnyHit, typename PrimitiveTest>
+bool wide_bvh<N>::traverse_nodes(
+    const wide_bvh_node<N>* nodes, const ray& r, double t_min, double t_max,
+    const PrimitiveTest& test_primitive, traversal_stats* counts
+) {
+    // Single-precision slab tests against boxes rounded outward, as in linear_bvh. Each node
+    // tests all of its children at once, then pushes the hit children from farthest to nearest,
+    // so the nearest is visited first. Entries remember where the ray enters them, and are
+    // dropped when popped if a closer hit has been found since.
+    ray_traversal<float> traversal(r);
+
+    if (Count)
+        counts->rays++;
+
+    auto closest_so_far = t_max;
+    bool hit_anything = false;
+
+    struct entry { uint32_t child; uint32_t count; float t_entry; };
+    entry stack[stack_size_limit];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+
+        float t_entry[N];
+        auto mask = node.boxes.hit(traversal, static_cast<float>(t_min),
+                                   static_cast<float>(closest_so_far), t_entry);
+        mask &= node.child_mask;
+
+        if (Count) {
+            counts->nodes_visited++;
+            for (int i = 0; i < N; i++)
+                counts->box_tests += (node.child_mask >> i) & 1;
+        }
+
+        // Insertion sort the hit children by decreasing entry distance onto the stack.
+        auto base = stack_size;
+        for (int i = 0; i < N; i++) {
+            if (!(mask & (1u << i)))
+                continue;
+
+            entry e = { node.child[i], node.count[i], t_entry[i] };
+            auto j = stack_size++;
+            while (j > base && stack[j-1].t_entry < e.t_entry) {
+                stack[j] = stack[j-1];
+                j--;
+            }
+            stack[j] = e;
+        }
+
+        // Pop entries, testing leaf primitives in place, until reaching a node to descend into.
+        bool descend = false;
+        while (stack_size > 0 && !descend) {
+            auto e = stack[--stack_size];
+            if (e.t_entry > closest_so_far)
+                continue;
+
+            if (e.count == 0) {
+                current = e.child;
+                descend = true;
+                continue;
+            }
+
+            if (Count)
+                counts->primitive_tests += e.count;
+
+            for (uint32_t i = 0; i < e.count; i++) {
+                double t_hit;
+                if (AnyHit) {
+                    if (test_primitive(e.child + i, t_max, t_hit))
+                        return true;
+                } else if (test_primitive(e.child + i, closest_so_far, t_hit)) {
+                    hit_anything = true;
+                    closest_so_far = t_hit;
+                }
+            }
+        }
+
+        if (!descend)
+            return hit_anything;
+    }
+}
+
+
+template <int N>
+unsigned wide_bvh<N>::hit_packet(
+    const ray_packet& rays, unsigned lanes, double t_min, double t_max[], hit_record rec[]
+) const {
+    // The packet version of traverse(). Stack entries carry the lanes that entered the child,
+    // and the nearest distance at which one of them did. Children are visited nearest first by
+    // that distance, and an entry is dropped when popped if every one of its lanes has found a
+    // closer hit since. Each lane sees the same box tests as in traverse(), so the packet finds
+    // the same closest hits.
+    float closest[ray_packet::max_size];
+    for (int k = 0; k < ray_packet::max_size; k++)
+        closest[k] = static_cast<float>(t_max[k]);
+
+    struct entry { uint32_t child; uint32_t count; unsigned lanes; float t_entry; };
+    entry stack[stack_size_limit];
+    int stack_size = 0;
+    uint32_t current = 0;
+    unsigned current_lanes = lanes;
+    unsigned hits = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+
+        // Test every child box against the node's lanes, and insertion sort the children that
+        // any lane enters onto the stack by decreasing entry distance.
+        auto base = stack_size;
+        for (int i = 0; i < N; i++) {
+            if (!(node.child_mask & (1u << i)))
+                continue;
+
+            float lower[3], upper[3];
+            for (int a = 0; a < 3; a++) {
+                lower[a] = node.boxes.lower[a][i];
+                upper[a] = node.boxes.upper[a][i];
+            }
+
+            entry e = { node.child[i], node.count[i], 0, 0 };
+            e.lanes = packet_box_hit(rays, current_lanes, lower, upper,
+                                     static_cast<float>(t_min), closest, e.t_entry);
+            if (!e.lanes)
+                continue;
+
+            auto j = stack_size++;
+            while (j > base && stack[j-1].t_entry < e.t_entry) {
+                stack[j] = stack[j-1];
+                j--;
+            }
+            stack[j] = e;
+        }
+
+        // Pop entries, testing leaf primitives in place, until reaching a node to descend into.
+        bool descend = false;
+        while (stack_size > 0 && !descend) {
+            auto e = stack[--stack_size];
+
+            unsigned live = 0;
+            for (int k = 0; k < rays.size; k++)
+                if ((e.lanes >> k) & 1 && e.t_entry <= t_max[k])
+                    live |= 1u << k;
+            if (!live)
+                continue;
+
+            if (e.count == 0) {
+                current = e.child;
+                current_lanes = live;
+                descend = true;
+                continue;
+            }
+
+            for (uint32_t i = 0; i < e.count; i++) {
+                auto found = primitives[e.child + i]->hit_packet(rays, live, t_min, t_max, rec);
+                if (found) {
+                    hits |= found;
+                    for (int k = 0; k < rays.size; k++)
+                        if ((found >> k) & 1)
+                            closest[k] = static_cast<float>(t_max[k]);
+                }
+            }
+        }
+
+        if (!descend)
+            return hits;
+    }
+}
+
+
+template <int N>
+bvh_stats wide_bvh<N>::stats() const {
+    bvh_stats stats;
+
+    auto area = [](const aabb_pack<float, N>& boxes, int i) -> double {
+        auto a = boxes.upper[0][i] - boxes.lower[0][i];
+        auto b = boxes.upper[1][i] - boxes.lower[1][i];
+        auto c = boxes.upper[2][i] - boxes.lower[2][i];
+        return 2.0*(a*b + b*c + c*a);
+    };
+
+    auto root_area = box.area();
+    if (root_area <= 0)
+        return stats;
+
+    // A ray reaching a node tests every child box. Interior children are pushed with the chance
+    // of reaching them, and leaf children add the chance of testing their primitives.
+    struct pending_node { uint32_t index; int depth; double p; };
+    std::vector<pending_node> pending = { {0, 1, 1.0} };
+
+    while (!pending.empty()) {
+        auto e = pending.back();
+        pending.pop_back();
+
+        const auto& n = nodes[e.index];
+
+        stats.node_count++;
+        stats.max_depth = std::max(stats.max_depth, e.depth);
+
+        for (int i = 0; i < N; i++) {
+            if (!(n.child_mask & (1u << i)))
+                continue;
+
+            stats.box_tests += e.p;
+
+            auto p = area(n.boxes, i) / root_area;
+            if (n.count[i] > 0)
+                stats.primitive_tests += p * n.count[i];
+            else
+                pending.push_back({n.child[i], e.depth + 1, p});
+        }
+    }
+
+    return stats;
+}
+
+
+#endif
@@ -0,0 +1,185 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Measures ray-box tests per second for the original division-based aabb::hit, for the slab
+// test on a precomputed ray_traversal, and for the packed sibling tests of aabb_pack. First it
+// checks that the packed tests agree with aabb::hit on rays that lie in the plane of a box face,
+// where a zero direction component makes the slab distances NaN.
+
+#include "rtweekend.h"
+
+#include "aabb.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+bool legacy_hit(const aabb& box, const ray& r, double t_min, double t_max) {
+    // The previous implementation of aabb::hit.
+    for (int a = 0; a < 3; a++) {
+        auto t0 = fmin((box.minimum[a] - r.origin()[a]) / r.direction()[a],
+                       (box.maximum[a] - r.origin()[a]) / r.direction()[a]);
+        auto t1 = fmax((box.minimum[a] - r.origin()[a]) / r.direction()[a],
+                       (box.maximum[a] - r.origin()[a]) / r.direction()[a]);
+        t_min = fmax(t0, t_min);
+        t_max = fmin(t1, t_max);
+        if (t_max <= t_min)
+            return false;
+    }
+    return true;
+}
+
+
+template <typename Test>
+void report(const char* name, long box_tests, const Test& test) {
+    auto start = std::chrono::steady_clock::now();
+    long hits = test();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "  " << std::left << std::setw(34) << name << std::right
+              << std::setw(8) << box_tests / elapsed.count() / 1e6 << " M boxes/s"
+              << "   (" << hits << " hits)\n";
+}
+
+
+template <typename T, int N>
+long pack_hits(const std::vector<aabb_pack<T,N>>& packs, const std::vector<ray>& rays) {
+    long hits = 0;
+    T t_entry[N];
+    for (const auto& r : rays) {
+        ray_traversal<T> traversal(r);
+        for (const auto& pack : packs) {
+            auto mask = pack.hit(traversal, T(0.001), std::numeric_limits<T>::infinity(), t_entry);
+            for (int i = 0; i < N; i++)
+                hits += (mask >> i) & 1;
+        }
+    }
+    return hits;
+}
+
+
+template <typename T, int N>
+std::vector<aabb_pack<T,N>> make_packs(const std::vector<aabb>& boxes) {
+    std::vector<aabb_pack<T,N>> packs(boxes.size() / N);
+    for (size_t i = 0; i < packs.size() * N; i++)
+        packs[i / N].set(static_cast<int>(i % N), boxes[i]);
+    return packs;
+}
+
+
+template <typename T, int N>
+long pack_disagreements(const std::vector<aabb>& boxes, const std::vector<ray>& rays) {
+    // The number of ray and box pairs where aabb_pack and aabb::hit disagree.
+    auto packs = make_packs<T,N>(boxes);
+    long count = 0;
+    T t_entry[N];
+    for (const auto& r : rays) {
+        ray_traversal<T> traversal(r);
+        for (size_t p = 0; p < packs.size(); p++) {
+            auto mask = packs[p].hit(traversal, T(0), std::numeric_limits<T>::infinity(), t_entry);
+            for (int i = 0; i < N; i++)
+                count += ((mask >> i) & 1) != boxes[p*N + i].hit(r, 0, infinity);
+        }
+    }
+    return count;
+}
+
+
+void check_face_plane_rays() {
+    // Rays that start in the plane of a face of the unit box, and run along that plane, either
+    // across the face or beside it, with a zero or negative zero direction component.
+    std::vector<aabb> boxes(8, aabb(point3(0,0,0), point3(1,1,1)));
+    std::vector<ray> rays;
+    for (int a = 0; a < 3; a++) {
+        for (auto plane : {0.0, 1.0}) {
+            for (auto zero : {0.0, -0.0}) {
+                for (auto offset : {0.5, 2.0}) {
+                    point3 origin(offset, offset, -1);
+                    vec3 direction(0, 0, 1);
+                    if (a == 2) {
+                        origin = point3(-1, offset, offset);
+                        direction = vec3(1, 0, 0);
+                    }
+                    origin[a] = plane;
+                    direction[a] = zero;
+                    rays.push_back(ray(origin, direction));
+                }
+            }
+        }
+    }
+
+    std::cout << "Face-plane rays: " << rays.size() << " rays, disagreements with aabb::hit:"
+              << " aabb_pack<double,4> " << pack_disagreements<double,4>(boxes, rays)
+              << ", aabb_pack<float,4> " << pack_disagreements<float,4>(boxes, rays)
+              << ", aabb_pack<float,8> " << pack_disagreements<float,8>(boxes, rays) << "\n\n";
+}
+
+
+int main() {
+    const int box_count = 4096;
+    const int ray_count = 2048;
+    const long box_tests = static_cast<long>(box_count) * ray_count;
+
+    check_face_plane_rays();
+
+    seed_random(0x5eed);
+
+    std::vector<aabb> boxes;
+    for (int i = 0; i < box_count; i++) {
+        auto center = point3(random_double(-10,10), random_double(-10,10), random_double(-10,10));
+        auto half = vec3(random_double(0.1,2), random_double(0.1,2), random_double(0.1,2));
+        boxes.push_back(aabb(center - half, center + half));
+    }
+
+    std::vector<ray> rays;
+    for (int i = 0; i < ray_count; i++)
+        rays.push_back(ray(point3(random_double(-12,12), random_double(-12,12), -15),
+                           random_in_unit_sphere() + vec3(0,0,1)));
+
+    std::cout << std::fixed << std::setprecision(1)
+              << box_count << " boxes x " << ray_count << " rays, one thread\n";
+
+    report("divide per box (previous)", box_tests, [&]() -> long {
+        long hits = 0;
+        for (const auto& r : rays)
+            for (const auto& box : boxes)
+                hits += legacy_hit(box, r, 0.001, infinity);
+        return hits;
+    });
+
+    report("aabb::hit(ray)", box_tests, [&]() -> long {
+        long hits = 0;
+        for (const auto& r : rays)
+            for (const auto& box : boxes)
+                hits += box.hit(r, 0.001, infinity);
+        return hits;
+    });
+
+    report("aabb::hit(ray_traversal)", box_tests, [&]() -> long {
+        long hits = 0;
+        for (const auto& r : rays) {
+            ray_traversal<double> traversal(r);
+            for (const auto& box : boxes)
+                hits += box.hit(traversal, 0.001, infinity);
+        }
+        return hits;
+    });
+
+    auto double2 = make_packs<double,2>(boxes);
+    auto double4 = make_packs<double,4>(boxes);
+    auto float4  = make_packs<float,4>(boxes);
+    auto float8  = make_packs<float,8>(boxes);
+
+    report("aabb_pack<double,2>", box_tests, [&] { return pack_hits(double2, rays); });
+    report("aabb_pack<double,4>", box_tests, [&] { return pack_hits(double4, rays); });
+    report("aabb_pack<float,4>",  box_tests, [&] { return pack_hits(float4,  rays); });
+    report("aabb_pack<float,8>",  box_tests, [&] { return pack_hits(float8,  rays); });
+}
@@ -0,0 +1,71 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Times BVH construction over a scene of randomly placed spheres, for both BVH classes and both
+// split methods.
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+#include "material.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+
+hittable_list random_spheres(int count) {
+    hittable_list objects;
+    auto mat = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+
+    for (int i = 0; i < count; i++) {
+        auto center = point3(random_double(-1000,1000), random_double(-1000,1000),
+                             random_double(-1000,1000));
+        objects.add(make_shared<sphere>(center, random_double(0.1, 2.0), mat));
+    }
+
+    return objects;
+}
+
+
+template <typename Build>
+double seconds_to_build(const Build& build) {
+    auto start = std::chrono::steady_clock::now();
+    build();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+int main(int argc, char* argv[]) {
+    int count = (argc > 1) ? std::atoi(argv[1]) : 1000000;
+
+    seed_random(0x5eed);
+    auto world = random_spheres(count);
+
+    std::cout << count << " spheres, " << std::thread::hardware_concurrency() << " threads\n"
+              << std::fixed << std::setprecision(3);
+
+    const bvh_split splits[] = { bvh_split::random_axis, bvh_split::sah };
+    for (auto split : splits) {
+        auto name = (split == bvh_split::sah) ? "sah        " : "random_axis";
+
+        auto flat = seconds_to_build([&] { linear_bvh bvh(world, 0, 1, split); });
+        auto tree = seconds_to_build([&] { bvh_node bvh(world, 0, 1, split); });
+
+        std::cout << "  " << name
+                  << "  linear_bvh: " << std::setw(7) << flat << " s"
+                  << "   bvh_node: " << std::setw(7) << tree << " s\n";
+    }
+}
@@ -0,0 +1,93 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Builds the BVHs of The Next Week's random_scene() and final_scene() with each bvh_split
+// method, as binary and 4-wide trees, and reports their size and expected traversal cost.
+
+#include "rtweekend.h"
+
+#include "bvh.h"
+#include "linear_bvh.h"
+#include "scenes.h"
+#include "wide_bvh.h"
+
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+void collect_bvhs(const shared_ptr<hittable>& object, std::vector<bvh_stats>& found) {
+    // Walk the scene down to its top-level BVHs, looking through lists, transforms and media.
+    if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+        found.push_back(node->stats());
+    } else if (auto flat = std::dynamic_pointer_cast<linear_bvh>(object)) {
+        found.push_back(flat->stats());
+    } else if (auto wide4 = std::dynamic_pointer_cast<wide_bvh<4>>(object)) {
+        found.push_back(wide4->stats());
+    } else if (auto wide8 = std::dynamic_pointer_cast<wide_bvh<8>>(object)) {
+        found.push_back(wide8->stats());
+    } else if (auto list = std::dynamic_pointer_cast<hittable_list>(object)) {
+        for (const auto& child : list->objects)
+            collect_bvhs(child, found);
+    } else if (auto moved = std::dynamic_pointer_cast<translate>(object)) {
+        collect_bvhs(moved->ptr, found);
+    } else if (auto rotated = std::dynamic_pointer_cast<rotate_y>(object)) {
+        collect_bvhs(rotated->ptr, found);
+    } else if (auto medium = std::dynamic_pointer_cast<constant_medium>(object)) {
+        collect_bvhs(medium->boundary, found);
+    }
+}
+
+
+template <typename Scene>
+void report(const char* name, const Scene& build_scene) {
+    std::cout << name << '\n'
+              << "  BVH  builder        nodes  depth  box tests  prim tests  expected cost\n";
+
+    const bvh_split splits[] = { bvh_split::random_axis, bvh_split::sah };
+    std::vector<bvh_stats> results[2];
+
+    for (int s = 0; s < 2; s++) {
+        // Reseed so that both builders see exactly the same primitives.
+        seed_random(0x5eed);
+        auto world = make_shared<hittable_list>(build_scene(splits[s]));
+
+        collect_bvhs(world, results[s]);
+    }
+
+    std::cout << std::fixed << std::setprecision(2);
+
+    for (size_t i = 0; i < results[0].size(); i++) {
+        for (int s = 0; s < 2; s++) {
+            const auto& stats = results[s][i];
+            std::cout << "  " << std::setw(3) << i+1
+                      << "  " << std::left << std::setw(12)
+                      << (splits[s] == bvh_split::sah ? "sah" : "random_axis") << std::right
+                      << std::setw(7) << stats.node_count
+                      << std::setw(7) << stats.max_depth
+                      << std::setw(11) << stats.box_tests
+                      << std::setw(12) << stats.primitive_tests
+                      << std::setw(15) << stats.expected_cost() << '\n';
+        }
+
+        std::cout << "       sah/random_axis cost ratio: "
+                  << results[1][i].expected_cost() / results[0][i].expected_cost() << "\n";
+    }
+
+    std::cout << '\n';
+}
+
+
+int main() {
+    for (int width : {2, 4}) {
+        std::cout << "BVH width " << width << "\n\n";
+        report("random_scene", [=](bvh_split split) { return random_scene(split, width); });
+        report("final_scene",  [=](bvh_split split) { return final_scene(split, width); });
+    }
+}
@@ -0,0 +1,204 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Traces the camera rays of an image through the 4- and 8-wide wide_bvh, one ray at a time and
+// in packets of 4, 8 and 16 neighboring pixels, and reports the rays traced per second. The
+// checksums of the hit distances show that packets find the same hits as single rays. First it
+// checks that packet_box_hit agrees with aabb::hit on rays that lie in the plane of a box face,
+// where a zero direction component makes the slab distances NaN.
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "linear_bvh.h"
+#include "scenes.h"
+#include "wide_bvh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+struct image_rays {
+    // Camera rays through the pixel centers, in blocks of block_width by block_height pixels,
+    // so that each run of block_width*block_height rays forms one packet.
+    int block_width, block_height;
+    std::vector<ray> rays;
+};
+
+
+image_rays camera_rays(const camera& cam, int width, int height, int block_size) {
+    image_rays image;
+    image.block_width = (block_size >= 8) ? 4 : (block_size >= 4 ? 2 : 1);
+    image.block_height = block_size / image.block_width;
+
+    for (int y = 0; y < height; y += image.block_height)
+        for (int x = 0; x < width; x += image.block_width)
+            for (int j = y; j < y + image.block_height; j++)
+                for (int i = x; i < x + image.block_width; i++)
+                    image.rays.push_back(cam.get_ray((i + 0.5) / width, (j + 0.5) / height));
+
+    return image;
+}
+
+
+void check_face_plane_rays() {
+    // Rays that start in the plane of a face of the unit box, and run along that plane, either
+    // across the face or beside it, with a zero or negative zero direction component.
+    std::vector<ray> rays;
+    for (int a = 0; a < 3; a++) {
+        for (auto plane : {0.0, 1.0}) {
+            for (auto zero : {0.0, -0.0}) {
+                for (auto offset : {0.5, 2.0}) {
+                    point3 origin(offset, offset, -1);
+                    vec3 direction(0, 0, 1);
+                    if (a == 2) {
+                        origin = point3(-1, offset, offset);
+                        direction = vec3(1, 0, 0);
+                    }
+                    origin[a] = plane;
+                    direction[a] = zero;
+                    rays.push_back(ray(origin, direction));
+                }
+            }
+        }
+    }
+
+    aabb box(point3(0,0,0), point3(1,1,1));
+    const float lower[3] = {0, 0, 0};
+    const float upper[3] = {1, 1, 1};
+    float t_max[ray_packet::max_size];
+    std::fill(t_max, t_max + ray_packet::max_size, std::numeric_limits<float>::infinity());
+
+    int disagreements = 0;
+    for (size_t first = 0; first < rays.size(); first += ray_packet::max_size) {
+        ray_packet packet;
+        packet.size = static_cast<int>(
+            std::min(rays.size() - first, static_cast<size_t>(ray_packet::max_size)));
+        for (int k = 0; k < packet.size; k++)
+            packet.set(k, rays[first + k]);
+
+        float t_entry;
+        auto mask = packet_box_hit(packet, (1u << packet.size) - 1, lower, upper, 0, t_max,
+                                   t_entry);
+        for (int k = 0; k < packet.size; k++)
+            disagreements += ((mask >> k) & 1) != box.hit(rays[first + k], 0, infinity);
+    }
+
+    std::cout << "Face-plane rays: " << rays.size() << " rays, disagreements of"
+              << " packet_box_hit with aabb::hit: " << disagreements << "\n\n";
+}
+
+
+template <typename Bvh>
+double trace_single(const Bvh& bvh, const image_rays& image, double& seconds) {
+    auto checksum = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    hit_record rec;
+    for (const auto& r : image.rays)
+        if (bvh.hit(r, 0.001, infinity, rec))
+            checksum += rec.t;
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return checksum;
+}
+
+
+template <typename Bvh>
+double trace_packets(const Bvh& bvh, const image_rays& image, double& seconds) {
+    auto lanes = image.block_width * image.block_height;
+    auto all_lanes = (1u << lanes) - 1;
+    auto checksum = 0.0;
+
+    auto start = std::chrono::steady_clock::now();
+    ray_packet packet;
+    hit_record rec[ray_packet::max_size];
+    for (size_t first = 0; first < image.rays.size(); first += lanes) {
+        for (int k = 0; k < lanes; k++)
+            packet.set(k, image.rays[first + k]);
+        packet.size = lanes;
+
+        double t_max[ray_packet::max_size];
+        for (int k = 0; k < ray_packet::max_size; k++)
+            t_max[k] = infinity;
+
+        auto hits = bvh.hit_packet(packet, all_lanes, 0.001, t_max, rec);
+        for (int k = 0; k < lanes; k++)
+            if ((hits >> k) & 1)
+                checksum += rec[k].t;
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return checksum;
+}
+
+
+template <typename Bvh>
+void compare(const char* name, const Bvh& bvh, const camera& cam, int width, int height) {
+    std::cout << "  " << name << '\n';
+
+    double seconds;
+    auto single = camera_rays(cam, width, height, 1);
+    auto reference = trace_single(bvh, single, seconds);
+    auto single_rate = single.rays.size() / seconds / 1e6;
+    std::cout << "    single ray   " << std::setw(8) << single_rate << " Mray/s"
+              << "   (checksum " << reference << ")\n";
+
+    for (int size = 4; size <= ray_packet::max_size; size *= 2) {
+        auto image = camera_rays(cam, width, height, size);
+        auto checksum = trace_packets(bvh, image, seconds);
+        auto rate = image.rays.size() / seconds / 1e6;
+        std::cout << "    packet of " << std::setw(2) << size << ' '
+                  << std::setw(8) << rate << " Mray/s  x" << rate / single_rate
+                  << "   (checksum " << checksum << ")\n";
+    }
+}
+
+
+void compare(const char* name, const hittable_list& objects, const camera& cam) {
+    // Image dimensions are multiples of 4, so that every packet is full.
+    const int width = 800;
+    const int height = 448;
+
+    wide_bvh<4> wide4(objects, 0, 1);
+    wide_bvh<8> wide8(objects, 0, 1);
+
+    std::cout << name << ": " << objects.objects.size() << " primitives, "
+              << width << 'x' << height << " camera rays\n";
+
+    compare("4-wide", wide4, cam, width, height);
+    compare("8-wide", wide8, cam, width, height);
+    std::cout << '\n';
+}
+
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+
+    check_face_plane_rays();
+
+    seed_random(0x5eed);
+
+    auto scene = random_scene(bvh_split::sah, 2);
+    auto flat = std::dynamic_pointer_cast<linear_bvh>(scene.objects[0]);
+    hittable_list spheres;
+    for (const auto& object : flat->objects)
+        spheres.add(object);
+
+    compare("random_scene", spheres,
+        camera(point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0, 10, 0, 0));
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittable_list cluster;
+    for (int j = 0; j < 1000; j++)
+        cluster.add(make_shared<sphere>(point3::random(0,165), 10, white));
+
+    compare("final_scene sphere cluster", cluster,
+        camera(point3(82,82,-400), point3(82,82,82), vec3(0,1,0), 40, 1, 0, 10, 0, 0));
+}
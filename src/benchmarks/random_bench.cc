@@ -0,0 +1,112 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Compares the throughput of the per-thread random_double() against the rand() path it
+// replaced, for raw draws and for unit-sphere samples, on one thread and on every core.
+
+#include "rtweekend.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+
+inline double rand_double() {
+    // The previous implementation of random_double().
+    return rand() / (RAND_MAX + 1.0);
+}
+
+
+template <typename Generator>
+inline vec3 sample_unit_sphere(Generator& gen) {
+    while (true) {
+        auto p = vec3(2*gen()-1, 2*gen()-1, 2*gen()-1);
+        if (p.length_squared() >= 1) continue;
+        return p;
+    }
+}
+
+
+template <typename Work>
+double samples_per_second(int thread_count, long samples_per_thread, const Work& work) {
+    std::vector<double> sums(thread_count);
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (int t = 0; t < thread_count; t++)
+        threads.emplace_back([&, t] { sums[t] = work(samples_per_thread); });
+    for (auto& thread : threads)
+        thread.join();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // Report the sums so the compiler cannot discard the work.
+    auto total = 0.0;
+    for (auto s : sums) total += s;
+    std::cerr << "  (checksum " << total << ")\n";
+
+    return thread_count * samples_per_thread / elapsed.count();
+}
+
+
+int main() {
+    const long samples = 20000000;
+    int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    auto rand_draws = [](long n) {
+        auto sum = 0.0;
+        for (long i = 0; i < n; i++) sum += rand_double();
+        return sum;
+    };
+
+    auto thread_draws = [](long n) {
+        auto sum = 0.0;
+        for (long i = 0; i < n; i++) sum += random_double();
+        return sum;
+    };
+
+    auto rand_spheres = [](long n) {
+        auto sum = 0.0;
+        auto gen = [] { return rand_double(); };
+        for (long i = 0; i < n; i++) sum += sample_unit_sphere(gen).x();
+        return sum;
+    };
+
+    auto thread_spheres = [](long n) {
+        auto sum = 0.0;
+        auto gen = [] { return random_double(); };
+        for (long i = 0; i < n; i++) sum += sample_unit_sphere(gen).x();
+        return sum;
+    };
+
+    std::cout << std::fixed << std::setprecision(1);
+
+    for (int threads : {1, cores}) {
+        std::cout << "Threads: " << threads << '\n';
+
+        auto a = samples_per_second(threads, samples, rand_draws);
+        auto b = samples_per_second(threads, samples, thread_draws);
+        std::cout << "  random_double()  rand(): " << std::setw(8) << a / 1e6 << " M/s"
+                  << "   per-thread: " << std::setw(8) << b / 1e6 << " M/s"
+                  << "   speedup: " << b / a << "x\n";
+
+        auto c = samples_per_second(threads, samples / 4, rand_spheres);
+        auto d = samples_per_second(threads, samples / 4, thread_spheres);
+        std::cout << "  unit sphere      rand(): " << std::setw(8) << c / 1e6 << " M/s"
+                  << "   per-thread: " << std::setw(8) << d / 1e6 << " M/s"
+                  << "   speedup: " << d / c << "x\n";
+
+        if (cores == 1) break;
+    }
+}
@@ -0,0 +1,111 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Traces the same rays through each scene as built, with its hittable classes, and through a
+// compiled_scene made from it, and reports the rays traced per second for closest-hit and
+// any-hit queries. The rays are camera rays and rays in random directions from random points
+// in the scene, which stand in for bounces. The checksums of the hit distances show that both
+// find the same hits, except in scenes with a constant_medium, whose hits are random.
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "compiled_scene.h"
+#include "scenes.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+void trace(const char* name, const hittable& world, const std::vector<ray>& rays) {
+    hit_record rec;
+    auto checksum = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        if (world.hit(r, 0.001, infinity, rec))
+            checksum += rec.t;
+    auto hit_rate = rays.size() / seconds_since(start) / 1e6;
+
+    long blocked = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        blocked += world.occluded(r, 0.001, infinity);
+    auto occluded_rate = rays.size() / seconds_since(start) / 1e6;
+
+    std::cout << "    " << std::left << std::setw(10) << name << std::right
+              << std::setw(10) << hit_rate << std::setw(10) << occluded_rate
+              << "   (checksum " << checksum << ", " << blocked << " blocked)\n";
+}
+
+
+void compare(const char* name, const hittable_list& world, const camera& cam, int ray_count) {
+    aabb bounds;
+    world.bounding_box(0, 1, bounds);
+
+    std::vector<ray> camera_rays, bounce_rays;
+    for (int i = 0; i < ray_count; i++) {
+        camera_rays.push_back(cam.get_ray(random_double(), random_double()));
+
+        auto origin = bounds.min() + (bounds.max() - bounds.min())
+                    * vec3(random_double(), random_double(), random_double());
+        bounce_rays.push_back(ray(origin, random_unit_vector(), random_double()));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    compiled_scene compiled(world, 0, 1);
+    auto compile_time = seconds_since(start);
+
+    std::cout << name << ": compiled in " << compile_time * 1e3 << " ms to "
+              << compiled.node_count() << " nodes over";
+    const char* type_names[] = {
+        "spheres", "moving spheres", "xy_rects", "xz_rects", "yz_rects", "boxes",
+        "sphere sets", "others"
+    };
+    for (int type = 0; type < static_cast<int>(primitive_type::count); type++) {
+        auto count = compiled.primitive_count(static_cast<primitive_type>(type));
+        if (count > 0)
+            std::cout << ' ' << count << ' ' << type_names[type];
+    }
+    std::cout << "\n  scene         hit/s  occluded/s   in Mray/s\n";
+
+    std::cout << "  " << ray_count << " camera rays\n";
+    trace("classes", world, camera_rays);
+    trace("compiled", compiled, camera_rays);
+    std::cout << "  " << ray_count << " bounce rays\n";
+    trace("classes", world, bounce_rays);
+    trace("compiled", compiled, bounce_rays);
+    std::cout << '\n';
+}
+
+
+int main() {
+    std::cout << std::fixed << std::setprecision(2);
+
+    seed_random(0x5eed);
+    const int ray_count = 1000000;
+
+    compare("random_scene", random_scene(),
+        camera(point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0.1, 10, 0, 1),
+        ray_count);
+
+    compare("cornell_box", cornell_box(),
+        camera(point3(278,278,-800), point3(278,278,0), vec3(0,1,0), 40, 1, 0, 10, 0, 1),
+        ray_count);
+
+    compare("final_scene", final_scene(),
+        camera(point3(478,278,-600), point3(278,278,0), vec3(0,1,0), 40, 1, 0, 10, 0, 1),
+        ray_count);
+}
@@ -0,0 +1,117 @@
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Traces camera rays through the binary linear_bvh and the 4- and 8-wide wide_bvh built over
+// the same primitives, and reports the nodes visited, boxes and primitives tested per ray, and
+// the rays traced per second.
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "linear_bvh.h"
+#include "scenes.h"
+#include "sphere_set.h"
+#include "wide_bvh.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+
+template <typename Bvh>
+void trace(const char* name, const Bvh& bvh, const std::vector<ray>& rays) {
+    // Count the work on one pass, then time a second pass without counting.
+    traversal_stats counts;
+    hit_record rec;
+    auto checksum = 0.0;
+    for (const auto& r : rays)
+        if (bvh.hit(r, 0.001, infinity, rec, counts))
+            checksum += rec.t;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& r : rays)
+        bvh.hit(r, 0.001, infinity, rec);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    auto per_ray = [&](long n) { return static_cast<double>(n) / counts.rays; };
+
+    std::cout << "  " << std::left << std::setw(12) << name << std::right
+              << std::setw(8) << bvh.node_count()
+              << std::setw(10) << per_ray(counts.nodes_visited)
+              << std::setw(10) << per_ray(counts.box_tests)
+              << std::setw(10) << per_ray(counts.primitive_tests)
+              << std::setw(10) << rays.size() / elapsed.count() / 1e6
+              << "   (checksum " << checksum << ")\n";
+}
+
+
+void compare(const char* name, const hittable_list& objects, const camera& cam, int ray_count) {
+    std::vector<ray> rays;
+    for (int i = 0; i < ray_count; i++)
+        rays.push_back(cam.get_ray(random_double(), random_double()));
+
+    linear_bvh binary(objects, 0, 1);
+    wide_bvh<4> wide4(objects, 0, 1);
+    wide_bvh<8> wide8(objects, 0, 1);
+
+    auto sets = pack_sphere_sets(objects, 0, 1);
+    wide_bvh<4> wide4_sets(sets, 0, 1);
+    wide_bvh<8> wide8_sets(sets, 0, 1);
+
+    std::cout << name << ": " << objects.objects.size() << " primitives, "
+              << ray_count << " camera rays\n"
+              << "  BVH            nodes   visited     boxes     prims    Mray/s\n";
+
+    trace("binary", binary, rays);
+    trace("4-wide", wide4, rays);
+    trace("8-wide", wide8, rays);
+    trace("4-wide sets", wide4_sets, rays);
+    trace("8-wide sets", wide8_sets, rays);
+    std::cout << '\n';
+}
+
+
+int main() {
+    const int ray_count = 200000;
+    std::cout << std::fixed << std::setprecision(2);
+
+    seed_random(0x5eed);
+
+    // The spheres of random_scene, taken from the primitive array of a binary BVH over them.
+    auto scene = random_scene(bvh_split::sah, 2);
+    auto flat = std::dynamic_pointer_cast<linear_bvh>(scene.objects[0]);
+    hittable_list spheres;
+    for (const auto& object : flat->objects)
+        spheres.add(object);
+
+    compare("random_scene", spheres,
+        camera(point3(13,2,3), point3(0,0,0), vec3(0,1,0), 20, 16.0/9.0, 0, 10, 0, 1),
+        ray_count);
+
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    hittable_list cluster;
+    for (int j = 0; j < 1000; j++)
+        cluster.add(make_shared<sphere>(point3::random(0,165), 10, white));
+
+    compare("final_scene sphere cluster", cluster,
+        camera(point3(82,82,-400), point3(82,82,82), vec3(0,1,0), 40, 1, 0, 10, 0, 1),
+        ray_count);
+
+    hittable_list cloud;
+    for (int i = 0; i < 100000; i++) {
+        auto center = point3(random_double(-1000,1000), random_double(-1000,1000),
+                             random_double(-1000,1000));
+        cloud.add(make_shared<sphere>(center, random_double(1, 10), white));
+    }
+
+    compare("100k sphere cloud", cloud,
+        camera(point3(0,0,-3000), point3(0,0,0), vec3(0,1,0), 40, 1, 0, 10, 0, 1),
+        ray_count);
+}
@@ -13,6 +13,35 @@
 
 #include "rtweekend.h"
 
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+template <typename T>
+struct ray_traversal {
+    // A ray prepared for slab tests. The reciprocal direction and its signs are computed once
+    // per ray, rather than once per box. In single precision the far reciprocal is padded by a
+    // few ulps, so that rounding in the test never loses a hit on a box rounded outward.
+    explicit ray_traversal(const ray& r) {
+        far_pad = (sizeof(T) < sizeof(double))
+            ? 1 + 2 * 3 * std::numeric_limits<T>::epsilon() : 1;
+
+        for (int a = 0; a < 3; a++) {
+            origin[a] = static_cast<T>(r.orig.e[a]);
+            inv_dir[a] = static_cast<T>(1 / r.dir.e[a]);
+            far_inv_dir[a] = inv_dir[a] * far_pad;
+            is_neg[a] = inv_dir[a] < 0;
+        }
+    }
+
+    T origin[3];
+    T inv_dir[3];
+    T far_inv_dir[3];  // inv_dir scaled by far_pad
+    T far_pad;
+    int is_neg[3];  // 1 where the direction is negative (including -0): picks each entry plane
+};
+
 
 class aabb {
     public:
@@ -23,17 +52,22 @@ class aabb {
         point3 max() const {return maximum; }
 
         bool hit(const ray& r, double t_min, double t_max) const {
+            return hit(ray_traversal<double>(r), t_min, t_max);
+        }
+
+        bool hit(const ray_traversal<double>& r, double t_min, double t_max) const {
+            // The ray's direction signs pick the entry and exit planes of each slab, so no
+            // min/max swap is needed. The comparisons are written so that a NaN distance (a ray
+            // in the plane of a slab) leaves the interval unchanged, and the loop has no early
+            // out, so it compiles to straight-line code.
+            const point3* corners[2] = { &minimum, &maximum };
             for (int a = 0; a < 3; a++) {
-                auto t0 = fmin((minimum[a] - r.origin()[a]) / r.direction()[a],
-                               (maximum[a] - r.origin()[a]) / r.direction()[a]);
-                auto t1 = fmax((minimum[a] - r.origin()[a]) / r.direction()[a],
-                               (maximum[a] - r.origin()[a]) / r.direction()[a]);
-                t_min = fmax(t0, t_min);
-                t_max = fmin(t1, t_max);
-                if (t_max <= t_min)
-                    return false;
+                auto t0 = (corners[r.is_neg[a]]->e[a]     - r.origin[a]) * r.inv_dir[a];
+                auto t1 = (corners[1 - r.is_neg[a]]->e[a] - r.origin[a]) * r.far_inv_dir[a];
+                t_min = t0 > t_min ? t0 : t_min;
+                t_max = t1 < t_max ? t1 : t_max;
             }
-            return true;
+            return t_min < t_max;
         }
 
         double area() const {
@@ -60,6 +94,117 @@ class aabb {
         point3 maximum;
 };
 
+
+template <typename T, int N>
+struct aabb_pack {
+    // N boxes stored by axis, for testing a ray against sibling boxes at once. Each axis of the
+    // test is a loop across the boxes, which the compiler can turn into SIMD instructions.
+    T lower[3][N];
+    T upper[3][N];
+
+    void set(int i, const aabb& box) {
+        for (int a = 0; a < 3; a++) {
+            lower[a][i] = static_cast<T>(box.minimum.e[a]);
+            upper[a][i] = static_cast<T>(box.maximum.e[a]);
+        }
+    }
+
+    // Returns a bit mask of the boxes that the ray enters within [t_min, t_max], and writes the
+    // distance at which the ray enters each box.
+    unsigned hit(const ray_traversal<T>& r, T t_min, T t_max, T t_entry[N]) const {
+        // As in aabb::hit, the ray's direction signs pick the entry and exit planes of each
+        // slab, and a NaN distance leaves the interval unchanged. The signs are the same for
+        // every box, so every box still runs the same instructions. The loop over boxes is
+        // outermost, so that it is the loop that gets vectorized.
+        const T* entry_plane[3];
+        const T* exit_plane[3];
+        for (int a = 0; a < 3; a++) {
+            entry_plane[a] = r.is_neg[a] ? upper[a] : lower[a];
+            exit_plane[a]  = r.is_neg[a] ? lower[a] : upper[a];
+        }
+
+        T t_near[N], t_far[N];
+        for (int i = 0; i < N; i++) {
+            auto box_near = t_min;
+            auto box_far = t_max;
+            for (int a = 0; a < 3; a++) {
+                auto t0 = (entry_plane[a][i] - r.origin[a]) * r.inv_dir[a];
+                auto t1 = (exit_plane[a][i] - r.origin[a]) * r.inv_dir[a] * r.far_pad;
+                box_near = t0 > box_near ? t0 : box_near;
+                box_far  = t1 < box_far  ? t1 : box_far;
+            }
+            t_near[i] = box_near;
+            t_far[i] = box_far;
+        }
+
+        unsigned mask = 0;
+        for (int i = 0; i < N; i++) {
+            t_entry[i] = t_near[i];
+            mask |= static_cast<unsigned>(t_near[i] <= t_far[i]) << i;
+        }
+        return mask;
+    }
+};
+
+
+// Hand-written kernels for the pack widths used by wide_bvh: four boxes to an SSE register, and
+// eight to an AVX register when the compiler targets AVX. They match the generic test exactly:
+// the min and max instructions return their second operand when either is NaN, just as the
+// comparisons above do.
+
+#if defined(__SSE__) || defined(_M_X64)
+template <>
+inline unsigned aabb_pack<float,4>::hit(
+    const ray_traversal<float>& r, float t_min, float t_max, float t_entry[4]
+) const {
+    auto box_near = _mm_set1_ps(t_min);
+    auto box_far  = _mm_set1_ps(t_max);
+    auto far_pad  = _mm_set1_ps(r.far_pad);
+
+    for (int a = 0; a < 3; a++) {
+        auto origin  = _mm_set1_ps(r.origin[a]);
+        auto inv_dir = _mm_set1_ps(r.inv_dir[a]);
+        auto entry_plane = _mm_loadu_ps(r.is_neg[a] ? upper[a] : lower[a]);
+        auto exit_plane  = _mm_loadu_ps(r.is_neg[a] ? lower[a] : upper[a]);
+        auto t0 = _mm_mul_ps(_mm_sub_ps(entry_plane, origin), inv_dir);
+        auto t1 = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(exit_plane, origin), inv_dir), far_pad);
+        box_near = _mm_max_ps(t0, box_near);
+        box_far  = _mm_min_ps(t1, box_far);
+    }
+
+    _mm_storeu_ps(t_entry, box_near);
+    return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(box_near, box_far)));
+}
+#endif
+
+
+#if defined(__AVX__)
+template <>
+inline unsigned aabb_pack<float,8>::hit(
+    const ray_traversal<float>& r, float t_min, float t_max, float t_entry[8]
+) const {
+    auto box_near = _mm256_set1_ps(t_min);
+    auto box_far  = _mm256_set1_ps(t_max);
+    auto far_pad  = _mm256_set1_ps(r.far_pad);
+
+    for (int a = 0; a < 3; a++) {
+        auto origin  = _mm256_set1_ps(r.origin[a]);
+        auto inv_dir = _mm256_set1_ps(r.inv_dir[a]);
+        auto entry_plane = _mm256_loadu_ps(r.is_neg[a] ? upper[a] : lower[a]);
+        auto exit_plane  = _mm256_loadu_ps(r.is_neg[a] ? lower[a] : upper[a]);
+        auto t0 = _mm256_mul_ps(_mm256_sub_ps(entry_plane, origin), inv_dir);
+        auto t1 = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(exit_plane, origin), inv_dir), far_pad);
+        box_near = _mm256_max_ps(t0, box_near);
+        box_far  = _mm256_min_ps(t1, box_far);
+    }
+
+    _mm256_storeu_ps(t_entry, box_near);
+    return static_cast<unsigned>(
+        _mm256_movemask_ps(_mm256_cmp_ps(box_near, box_far, _CMP_LE_OQ)));
+}
+#endif
+
+
 aabb surrounding_box(aabb box0, aabb box1) {
     vec3 small(fmin(box0.min().x(), box1.min().x()),
                fmin(box0.min().y(), box1.min().y()),
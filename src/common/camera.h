@@ -49,12 +49,18 @@ class camera {
         }
 
         ray get_ray(double s, double t) const {
-            vec3 rd = lens_radius * random_in_unit_disk();
-            vec3 offset = u * rd.x() + v * rd.y();
+            // The lens and shutter each take their own sample dimensions, and only when they
+            // have an extent to sample: a pinhole camera with an instant shutter draws nothing.
+            vec3 offset(0,0,0);
+            if (lens_radius > 0) {
+                vec3 rd = lens_radius * random_in_unit_disk();
+                offset = u * rd.x() + v * rd.y();
+            }
+            auto time = (time1 > time0) ? random_double(time0, time1) : time0;
             return ray(
                 origin + offset,
                 lower_left_corner + s*horizontal + t*vertical - origin - offset,
-                random_double(time0, time1)
+                time
             );
         }
 
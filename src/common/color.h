@@ -39,4 +39,10 @@ void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
 }
 
 
+inline double luminance(const color& c) {
+    // Relative luminance of a linear color with Rec. 709 primaries.
+    return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+}
+
+
 #endif
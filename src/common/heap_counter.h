@@ -0,0 +1,76 @@
+#ifndef HEAP_COUNTER_H
+#define HEAP_COUNTER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+// Replaces the global operator new and operator delete, in all their replaceable forms, with
+// ones that count the allocations made, so that a program can check how often it allocates.
+// This is for diagnostic builds only: the renderers include it only when built with the
+// COUNT_HEAP_ALLOCATIONS option. Include this header in only one source file of a program.
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+
+inline std::atomic<long>& heap_allocation_count() {
+    static std::atomic<long> count(0);
+    return count;
+}
+
+
+inline void* counted_allocation(std::size_t size) noexcept {
+    heap_allocation_count().fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+
+void* operator new(std::size_t size) {
+    if (void* p = counted_allocation(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void* operator new[](std::size_t size) {
+    if (void* p = counted_allocation(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_allocation(size);
+}
+
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_allocation(size);
+}
+
+
+// GCC warns when it inlines one of the deletes below and sees free() given a pointer from
+// operator new, so the call to free() is kept out of line.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+inline void counted_release(void* p) noexcept {
+    std::free(p);
+}
+
+
+void operator delete(void* p) noexcept { counted_release(p); }
+void operator delete[](void* p) noexcept { counted_release(p); }
+void operator delete(void* p, std::size_t) noexcept { counted_release(p); }
+void operator delete[](void* p, std::size_t) noexcept { counted_release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_release(p); }
+
+
+#endif
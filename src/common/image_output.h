@@ -0,0 +1,322 @@
+#ifndef IMAGE_OUTPUT_H
+#define IMAGE_OUTPUT_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "rtw_stb_image_write.h"
+#include "shared_framebuffer.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+    #include <fcntl.h>
+    #include <io.h>
+#endif
+
+
+// Image Formats
+
+enum class image_format {
+    ppm_ascii,  // P3 PPM, 8-bit gamma-corrected text
+    ppm,        // P6 PPM, 8-bit gamma-corrected binary
+    png,        // 8-bit gamma-corrected PNG
+    pfm,        // Portable float map, linear 32-bit float
+    hdr,        // Radiance RGBE, linear
+    raw         // Headerless linear 32-bit float RGB, rows from the top, native byte order
+};
+
+
+inline bool parse_image_format(const std::string& name, image_format& format) {
+    if      (name == "p3")  format = image_format::ppm_ascii;
+    else if (name == "ppm" || name == "p6") format = image_format::ppm;
+    else if (name == "png") format = image_format::png;
+    else if (name == "pfm") format = image_format::pfm;
+    else if (name == "hdr") format = image_format::hdr;
+    else if (name == "raw") format = image_format::raw;
+    else return false;
+    return true;
+}
+
+
+inline image_format image_format_for_path(const std::string& path) {
+    // Chooses the format from the file extension. Files are written as binary PPM unless the
+    // extension names another format.
+    auto dot = path.find_last_of('.');
+    image_format format = image_format::ppm;
+    if (dot != std::string::npos)
+        parse_image_format(path.substr(dot + 1), format);
+    return format;
+}
+
+
+inline bool replace_file(const std::string& from, const std::string& to) {
+    // Renames from over to. Readers of to see either the old or the new file, never a partial
+    // one.
+    if (std::rename(from.c_str(), to.c_str()) == 0)
+        return true;
+
+    // Some systems will not rename over an existing file.
+    std::remove(to.c_str());
+    return std::rename(from.c_str(), to.c_str()) == 0;
+}
+
+
+// Image Buffers
+
+struct image_buffer {
+    // Linear RGB colors, three floats per pixel, in rows from the top of the image.
+    int width  = 0;
+    int height = 0;
+    std::vector<float> rgb;
+    uint64_t samples = 0;  // Samples taken to make the image, for viewers
+};
+
+
+inline unsigned char to_display_byte(float linear) {
+    // Gamma-correct for gamma=2.0 and translate to [0,255], as write_color does. NaN maps to 0.
+    if (linear != linear) linear = 0;
+    return static_cast<unsigned char>(256 * clamp(sqrt(fmax(0.0, linear)), 0.0, 0.999));
+}
+
+
+bool write_image(std::ostream& out, const image_buffer& image, image_format format) {
+    // Encodes the image to the output stream, which must be in binary mode for every format but
+    // ASCII PPM. The Radiance format can only be written to a file, with write_image_file.
+    auto pixel_count = static_cast<size_t>(image.width) * image.height;
+
+    if (format == image_format::ppm_ascii) {
+        out << "P3\n" << image.width << ' ' << image.height << "\n255\n";
+        for (size_t k = 0; k < 3*pixel_count; k += 3) {
+            out << int(to_display_byte(image.rgb[k]))   << ' '
+                << int(to_display_byte(image.rgb[k+1])) << ' '
+                << int(to_display_byte(image.rgb[k+2])) << '\n';
+        }
+        return bool(out);
+    }
+
+    if (format == image_format::pfm || format == image_format::raw) {
+        // A negative PFM scale marks little-endian data, and PFM rows run from the bottom up.
+        if (format == image_format::pfm) {
+            uint16_t probe = 1;
+            auto little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+            out << "PF\n" << image.width << ' ' << image.height << '\n'
+                << (little_endian ? "-1.0" : "1.0") << '\n';
+        }
+
+        auto row_bytes = static_cast<std::streamsize>(3 * image.width * sizeof(float));
+        for (int j = 0; j < image.height; j++) {
+            auto row = (format == image_format::pfm) ? image.height-1 - j : j;
+            out.write(reinterpret_cast<const char*>(&image.rgb[3 * size_t(row) * image.width]),
+                      row_bytes);
+        }
+        return bool(out);
+    }
+
+    std::vector<unsigned char> bytes(3*pixel_count);
+    for (size_t k = 0; k < bytes.size(); k++)
+        bytes[k] = to_display_byte(image.rgb[k]);
+
+    if (format == image_format::ppm) {
+        out << "P6\n" << image.width << ' ' << image.height << "\n255\n";
+        out.write(reinterpret_cast<const char*>(bytes.data()),
+                  static_cast<std::streamsize>(bytes.size()));
+        return bool(out);
+    }
+
+    if (format == image_format::png) {
+        int length = 0;
+        auto png = stbi_write_png_to_mem(bytes.data(), 3*image.width, image.width, image.height,
+                                         3, &length);
+        if (!png)
+            return false;
+        out.write(reinterpret_cast<const char*>(png), length);
+        free(png);
+        return bool(out);
+    }
+
+    return false;
+}
+
+
+bool write_image_file(const std::string& path, const image_buffer& image, image_format format) {
+    // Writes the image to a temporary file, then moves it into place, so that programs watching
+    // the file never read a partial image.
+    auto temporary = path + ".tmp";
+
+    if (format == image_format::hdr) {
+        if (!stbi_write_hdr(temporary.c_str(), image.width, image.height, 3, image.rgb.data()))
+            return false;
+    } else {
+        std::ofstream out(temporary, std::ios::binary);
+        if (!write_image(out, image, format))
+            return false;
+    }
+
+    return replace_file(temporary, path);
+}
+
+
+inline void set_binary_mode(std::FILE* stream) {
+    // Binary formats written to a standard stream must not have their newlines translated.
+    #ifdef _WIN32
+        _setmode(_fileno(stream), _O_BINARY);
+    #else
+        (void) stream;
+    #endif
+}
+
+
+// Image Writer
+
+class image_writer {
+    // Encodes and writes images on a background thread, so that the render threads never wait
+    // for compression or disk. Only the most recent image submitted for writing is kept: one
+    // that is still waiting when another arrives is dropped.
+    public:
+        image_writer() : pending(false), stopping(false), failed(false) {}
+
+        ~image_writer() { finish(); }
+
+        // Queue an image to be written to path, or to standard output if path is empty. A path
+        // of the form "shm:/name" publishes the image to the POSIX shared memory object /name
+        // (see shared_framebuffer.h), in which case the format is ignored.
+        void submit(image_buffer image, const std::string& path, image_format format);
+
+        // Wait until every queued image has been written, and stop the writer thread.
+        void finish();
+
+        // Returns true if a write has failed since the last call, and forgets the failure, so
+        // that the writes that follow can be judged on their own.
+        bool clear_failure() {
+            std::lock_guard<std::mutex> guard(lock);
+            auto had_failed = failed;
+            failed = false;
+            return had_failed;
+        }
+
+    private:
+        struct job {
+            image_buffer image;
+            std::string path;
+            image_format format;
+        };
+
+        mutable std::mutex lock;
+        std::condition_variable wake;
+        std::thread thread;
+        job next;
+        bool pending;
+        bool stopping;
+        bool failed;
+
+        shared_framebuffer shared;   // Used only by the writer thread
+        std::string shared_name;
+
+        void run();
+        bool write(const job& current);
+};
+
+
+void image_writer::submit(image_buffer image, const std::string& path, image_format format) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    next.image.width  = image.width;
+    next.image.height = image.height;
+    next.image.rgb.swap(image.rgb);
+    next.image.samples = image.samples;
+    next.path = path;
+    next.format = format;
+    pending = true;
+
+    if (!thread.joinable()) {
+        stopping = false;
+        thread = std::thread(&image_writer::run, this);
+    }
+
+    wake.notify_one();
+}
+
+
+void image_writer::finish() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+        wake.notify_one();
+    }
+
+    if (thread.joinable())
+        thread.join();
+}
+
+
+void image_writer::run() {
+    job current;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return pending || stopping; });
+            if (!pending)
+                return;
+
+            current.image.width  = next.image.width;
+            current.image.height = next.image.height;
+            current.image.rgb.swap(next.image.rgb);
+            current.image.samples = next.image.samples;
+            current.path = next.path;
+            current.format = next.format;
+            pending = false;
+        }
+
+        if (!write(current)) {
+            std::lock_guard<std::mutex> guard(lock);
+            failed = true;
+        }
+    }
+}
+
+
+bool image_writer::write(const job& current) {
+    const auto& image = current.image;
+
+    if (current.path.empty()) {
+        set_binary_mode(stdout);
+        auto written = (current.format != image_format::hdr)
+                    && write_image(std::cout, image, current.format);
+        std::cout.flush();
+        return written;
+    }
+
+    if (current.path.compare(0, 4, "shm:") == 0) {
+        auto name = current.path.substr(4);
+        if (!shared.is_open() || name != shared_name) {
+            if (!shared.open(name, image.width, image.height))
+                return false;
+            shared_name = name;
+        }
+        shared.publish(image.rgb.data(), image.samples);
+        return true;
+    }
+
+    return write_image_file(current.path, image, current.format);
+}
+
+
+#endif
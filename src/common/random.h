@@ -0,0 +1,188 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <atomic>
+#include <cstdint>
+
+
+inline uint64_t splitmix64(uint64_t& state) {
+    // Steele, Lea & Flood's SplitMix64. Used to expand a single seed into generator state.
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+
+class xoshiro256 {
+    // Blackman & Vigna's xoshiro256** generator: 256 bits of state, period 2^256 - 1.
+    public:
+        xoshiro256(uint64_t seed_value = 0) { seed(seed_value); }
+
+        void seed(uint64_t seed_value) {
+            for (int i = 0; i < 4; i++)
+                s[i] = splitmix64(seed_value);
+        }
+
+        uint64_t next() {
+            const uint64_t result = rotl(s[1] * 5, 7) * 9;
+            const uint64_t t = s[1] << 17;
+
+            s[2] ^= s[0];
+            s[3] ^= s[1];
+            s[1] ^= s[2];
+            s[0] ^= s[3];
+            s[2] ^= t;
+            s[3] = rotl(s[3], 45);
+
+            return result;
+        }
+
+    private:
+        uint64_t s[4];
+
+        static uint64_t rotl(uint64_t x, int k) {
+            return (x << k) | (x >> (64 - k));
+        }
+};
+
+
+class pcg32 {
+    // O'Neill's PCG32 (XSH-RR variant): 64 bits of state, 32-bit output. Two draws are combined
+    // to produce each 64-bit value.
+    public:
+        pcg32(uint64_t seed_value = 0) { seed(seed_value); }
+
+        void seed(uint64_t seed_value) {
+            inc = (splitmix64(seed_value) << 1) | 1;
+            state = 0;
+            next32();
+            state += splitmix64(seed_value);
+            next32();
+        }
+
+        uint32_t next32() {
+            uint64_t old = state;
+            state = old * 6364136223846793005ull + inc;
+            auto xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            auto rot = static_cast<uint32_t>(old >> 59);
+            return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+        }
+
+        uint64_t next() {
+            uint64_t high = next32();
+            return (high << 32) | next32();
+        }
+
+    private:
+        uint64_t state;
+        uint64_t inc;
+};
+
+
+// The generator behind random_double() and friends. Any class with seed(uint64_t) and a
+// uint64_t next() method can be substituted here.
+using random_generator = xoshiro256;
+
+
+// Every thread owns its own generator, so drawing random numbers takes no locks and shares no
+// cache lines. Threads are seeded from the global seed plus the order in which they first draw.
+
+inline std::atomic<uint64_t>& random_seed_base() {
+    static std::atomic<uint64_t> base(0x5eed);
+    return base;
+}
+
+inline std::atomic<uint64_t>& random_thread_ordinal() {
+    static std::atomic<uint64_t> ordinal(0);
+    return ordinal;
+}
+
+inline random_generator& thread_random_generator() {
+    thread_local random_generator generator(
+        random_seed_base().load() + 0x632be59bd9b4e019ull * random_thread_ordinal()++);
+    return generator;
+}
+
+inline void seed_random(uint64_t seed_value) {
+    // Reseeds the calling thread's generator, and sets the base seed for threads that have not
+    // yet drawn any random numbers.
+    random_seed_base() = seed_value;
+    thread_random_generator().seed(seed_value);
+}
+
+inline double random_unit_double(uint64_t bits) {
+    // Maps the high 53 bits of a random integer to a double in [0,1).
+    return (bits >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// Sample Streams
+//
+// While rendering, random numbers are not drawn from the thread's generator. Instead, each
+// number is a function of (pixel, sample index, bounce, dimension), where the dimension counts
+// the draws made so far in the current bounce. A pixel sample therefore sees the same random
+// numbers no matter which thread renders it or in what order, so renders are bit-identical
+// across any thread count. Keying on the bounce keeps the numbers for later bounces fixed even if
+// an earlier bounce consumes a varying number of draws. The function itself is chosen by the
+// sampler (see sampler.h).
+
+inline uint64_t hash64(uint64_t x) {
+    // The SplitMix64 output finalizer: a fast bijective mix of all 64 bits.
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+struct sample_stream {
+    bool active;
+    uint32_t pixel_x;
+    uint32_t pixel_y;
+    uint64_t pixel_key;   // Hash of the seed and pixel
+    uint64_t key;         // Hash of the seed, pixel and sample index
+    uint64_t sample_index;
+    uint64_t bounce;
+    uint64_t dimension;   // Next dimension to be drawn in this bounce
+};
+
+inline sample_stream& thread_sample_stream() {
+    thread_local sample_stream stream = { false, 0, 0, 0, 0, 0, 0, 0 };
+    return stream;
+}
+
+inline void begin_sample_stream(uint32_t pixel_x, uint32_t pixel_y, uint64_t sample_index) {
+    // Directs the calling thread's random numbers to the stream for one pixel sample.
+    auto& stream = thread_sample_stream();
+    stream.active = true;
+    stream.pixel_x = pixel_x;
+    stream.pixel_y = pixel_y;
+    auto pixel = (static_cast<uint64_t>(pixel_y) << 32) | pixel_x;
+    stream.pixel_key = hash64(random_seed_base().load() ^ hash64(pixel));
+    stream.key = hash64(stream.pixel_key + sample_index);
+    stream.sample_index = sample_index;
+    stream.bounce = 0;
+    stream.dimension = 0;
+}
+
+inline void set_sample_bounce(int bounce) {
+    // Starts drawing from the dimensions of the given bounce. Bounce 0 belongs to the camera.
+    auto& stream = thread_sample_stream();
+    stream.bounce = static_cast<uint64_t>(bounce);
+    stream.dimension = 0;
+}
+
+inline void end_sample_stream() {
+    // Returns the calling thread to its own generator.
+    thread_sample_stream().active = false;
+}
+
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include <limits>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+
+struct ray_packet {
+    // A group of up to max_size rays, stored by axis so that a test can run across them in
+    // loops the compiler turns into SIMD instructions. Coherent rays, such as the camera rays of
+    // neighboring pixels, then visit the same BVH nodes and primitives together.
+    //
+    // Tests work on groups of group_size lanes, skipping the groups with no lanes in the mask
+    // they are given, and compute every lane of the other groups. So every lane must hold a
+    // valid ray: a new packet starts with a harmless placeholder in each, and arrays indexed by
+    // lane, such as t_max, must have max_size entries.
+    static const int max_size = 16;
+    static const int group_size = 4;
+
+    int size = 0;  // Lanes in use, from 0
+
+    double origin[3][max_size];
+    double direction[3][max_size];
+    double time[max_size];
+
+    // Single precision copies for slab tests, as in ray_traversal<float>.
+    float box_origin[3][max_size];
+    float inv_dir[3][max_size];
+    float far_pad = 1 + 2 * 3 * std::numeric_limits<float>::epsilon();
+
+    ray_packet() {
+        for (int k = 0; k < max_size; k++)
+            set(k, ray(point3(0,0,0), vec3(0,0,1), 0));
+    }
+
+    void set(int k, const ray& r) {
+        for (int a = 0; a < 3; a++) {
+            origin[a][k] = r.orig.e[a];
+            direction[a][k] = r.dir.e[a];
+        }
+        time[k] = r.tm;
+        prepare(k);
+    }
+
+    // Recompute the slab test data of lane k after its origin or direction has changed.
+    void prepare(int k) {
+        for (int a = 0; a < 3; a++) {
+            box_origin[a][k] = static_cast<float>(origin[a][k]);
+            inv_dir[a][k] = static_cast<float>(1 / direction[a][k]);
+        }
+    }
+
+    ray get(int k) const {
+        return ray(point3(origin[0][k], origin[1][k], origin[2][k]),
+                   vec3(direction[0][k], direction[1][k], direction[2][k]),
+                   time[k]);
+    }
+};
+
+
+inline unsigned lane_group_mask(unsigned lanes, int first) {
+    // The lanes of the group starting at lane first, as the low bits of the result.
+    return (lanes >> first) & ((1u << ray_packet::group_size) - 1);
+}
+
+
+inline unsigned packet_box_hit(
+    const ray_packet& rays, unsigned lanes, const float lower[3], const float upper[3],
+    float t_min, const float t_max[], float& t_entry
+) {
+    // Returns the mask of the given lanes whose rays enter the box within [t_min, t_max[k]],
+    // and sets t_entry to the nearest distance at which one of them enters. Each lane runs the
+    // same arithmetic as aabb_pack::hit does for a single ray, so a packet finds exactly the
+    // boxes that its rays would find one at a time. The rays' signs differ between lanes, so
+    // the entry and exit planes are chosen with a mask rather than a branch.
+    const int group_size = ray_packet::group_size;
+    unsigned mask = 0;
+    t_entry = std::numeric_limits<float>::infinity();
+
+    for (int g = 0; g < rays.size; g += group_size) {
+        auto group_lanes = lane_group_mask(lanes, g);
+        if (!group_lanes)
+            continue;
+
+        float t_near[group_size];
+        unsigned group_mask = 0;
+
+#if defined(__SSE__) || defined(_M_X64)
+        auto box_near = _mm_set1_ps(t_min);
+        auto box_far  = _mm_loadu_ps(t_max + g);
+        auto far_pad  = _mm_set1_ps(rays.far_pad);
+        auto zero     = _mm_setzero_ps();
+
+        for (int a = 0; a < 3; a++) {
+            auto origin  = _mm_loadu_ps(rays.box_origin[a] + g);
+            auto inv_dir = _mm_loadu_ps(rays.inv_dir[a] + g);
+            auto is_neg  = _mm_cmplt_ps(inv_dir, zero);
+            auto t_lower = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(lower[a]), origin), inv_dir);
+            auto t_upper = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(upper[a]), origin), inv_dir);
+            auto t0 = _mm_or_ps(_mm_and_ps(is_neg, t_upper), _mm_andnot_ps(is_neg, t_lower));
+            auto t1 = _mm_or_ps(_mm_and_ps(is_neg, t_lower), _mm_andnot_ps(is_neg, t_upper));
+            box_near = _mm_max_ps(t0, box_near);
+            box_far  = _mm_min_ps(_mm_mul_ps(t1, far_pad), box_far);
+        }
+
+        _mm_storeu_ps(t_near, box_near);
+        group_mask = static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(box_near, box_far)));
+#else
+        for (int i = 0; i < group_size; i++) {
+            auto k = g + i;
+            auto box_near = t_min;
+            auto box_far = t_max[k];
+            for (int a = 0; a < 3; a++) {
+                auto is_neg = rays.inv_dir[a][k] < 0;
+                auto t0 = ((is_neg ? upper[a] : lower[a]) - rays.box_origin[a][k])
+                        * rays.inv_dir[a][k];
+                auto t1 = ((is_neg ? lower[a] : upper[a]) - rays.box_origin[a][k])
+                        * rays.inv_dir[a][k] * rays.far_pad;
+                box_near = t0 > box_near ? t0 : box_near;
+                box_far  = t1 < box_far  ? t1 : box_far;
+            }
+            t_near[i] = box_near;
+            group_mask |= static_cast<unsigned>(box_near <= box_far) << i;
+        }
+#endif
+
+        group_mask &= group_lanes;
+        if (!group_mask)
+            continue;
+
+        mask |= group_mask << g;
+        for (int i = 0; i < group_size; i++)
+            if ((group_mask >> i) & 1 && t_near[i] < t_entry)
+                t_entry = t_near[i];
+    }
+
+    return mask;
+}
+
+
+#endif
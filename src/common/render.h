@@ -0,0 +1,1157 @@
+#ifndef RENDER_H
+#define RENDER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "image_output.h"
+#include "ray_packet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// Render Options
+
+struct render_options {
+    int threads           = 0;   // Worker thread count; 0 uses every hardware thread.
+    int tile_size         = 16;  // Tile edge length in pixels.
+    int samples_per_pixel = 0;   // Overrides the scene's sample count when non-zero.
+    int scene             = 0;   // Scene number, for programs with several; 0 is the default.
+    int bvh_width         = 4;   // Children per BVH node (2, 4 or 8), for programs with BVHs.
+    sampler_type sampler  = sampler_type::sobol;  // How pixel samples choose random numbers.
+    int packet_size       = 0;   // Camera rays traced together (4, 8 or 16); 0 traces singly.
+    bool compiled         = false;  // Trace a compiled copy of the scene, where supported.
+
+    std::string output;          // Image file to write; standard output if empty.
+    std::string format;          // Output image format; by default, from the file extension.
+
+    double adaptive_error = 0;   // Target image noise for adaptive sampling; 0 samples every pixel.
+    std::string sample_map;      // File to write the per-pixel sample counts to, if not empty.
+
+    bool progressive = false;    // Render in passes of increasing samples per pixel.
+    std::string preview;         // Image file or "shm:/name" to show the render in progress.
+    double preview_interval = 10;      // Seconds between preview updates.
+
+    std::string checkpoint;      // File to resume from, if it exists, and to save progress to.
+    double checkpoint_interval = 300;  // Seconds between checkpoint saves.
+
+    double time_limit   = 0;     // Seconds to render for; 0 for no limit.
+    double target_error = 0;     // Estimated image error to render down to; 0 for no target.
+};
+
+
+inline void print_render_usage(const char* program) {
+    std::cerr << "Usage: " << program << " [options] > image.ppm\n"
+              << "  --threads <n>     Number of render threads (default: all cores)\n"
+              << "  --tile-size <n>   Tile edge length in pixels (default: 16)\n"
+              << "  --samples <n>     Override the scene's samples per pixel\n"
+              << "  --scene <n>       Select the scene, for programs with several\n"
+              << "  --bvh-width <n>   Children per BVH node: 2, 4 or 8 (default: 4)\n"
+              << "  --sampler <name>  Sample pattern: independent, sobol, halton or blue-noise\n"
+              << "                    (default: sobol; halton is the slowest to compute)\n"
+              << "  --packet <n>      Trace camera rays in packets of n neighboring pixels: 4, 8\n"
+              << "                    or 16, for programs that support it (default: 0, off)\n"
+              << "  --compiled        Trace a compiled copy of the scene, with its primitives in\n"
+              << "                    arrays by type, for programs that support it\n"
+              << "  --output <file>   Write the image to file instead of standard output\n"
+              << "  --format <name>   Image format: p3, ppm (binary), png, pfm, hdr or raw\n"
+              << "                    (default: p3 on standard output, else from the extension)\n"
+              << "  --adaptive <e>    Give each pixel samples in proportion to its noise: a pixel\n"
+              << "                    whose displayed standard error at the full --samples\n"
+              << "                    would be e takes them all, e.g. 0.1 (default: off)\n"
+              << "  --sample-map <f>  Write the samples taken in each pixel to f, as a PPM image\n"
+              << "  --progressive     Render the whole image at 1 sample per pixel, then refine\n"
+              << "                    it in passes that double the samples\n"
+              << "  --preview <f>     Publish the image as it renders, to image file f, or to\n"
+              << "                    the POSIX shared memory object /name if f is shm:/name\n"
+              << "  --preview-interval <s>     Seconds between preview updates (default: 10)\n"
+              << "  --checkpoint <f>  Resume from checkpoint f if it exists, and save progress\n"
+              << "                    to it. Rerun with more --samples to add to a finished image\n"
+              << "  --checkpoint-interval <s>  Seconds between checkpoint saves (default: 300)\n"
+              << "  --time-limit <s>  Keep refining the image in passes for s seconds\n"
+              << "  --target-error <e>  Keep refining the image in passes until the RMS standard\n"
+              << "                    error of its displayed pixels is below e, as a fraction of\n"
+              << "                    white, e.g. 0.01. With either budget,\n"
+              << "                    --samples limits the samples per pixel\n";
+}
+
+
+render_options parse_render_options(int argc, char* argv[]) {
+    render_options options;
+
+    for (int i = 1; i < argc; i++) {
+        auto has_value = (i+1 < argc);
+
+        if (has_value && std::strcmp(argv[i], "--threads") == 0) {
+            options.threads = std::max(0, atoi(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--tile-size") == 0) {
+            options.tile_size = std::max(1, atoi(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--samples") == 0) {
+            options.samples_per_pixel = std::max(0, atoi(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--scene") == 0) {
+            options.scene = std::max(0, atoi(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--bvh-width") == 0) {
+            options.bvh_width = atoi(argv[++i]);
+            if (options.bvh_width != 2 && options.bvh_width != 4 && options.bvh_width != 8) {
+                std::cerr << "ERROR: BVH width must be 2, 4 or 8.\n";
+                print_render_usage(argv[0]);
+                exit(1);
+            }
+        } else if (has_value && std::strcmp(argv[i], "--sampler") == 0) {
+            if (!parse_sampler_type(argv[++i], options.sampler)) {
+                std::cerr << "ERROR: Unknown sampler '" << argv[i] << "'.\n";
+                print_render_usage(argv[0]);
+                exit(1);
+            }
+        } else if (has_value && std::strcmp(argv[i], "--packet") == 0) {
+            options.packet_size = atoi(argv[++i]);
+            if (options.packet_size == 1)
+                options.packet_size = 0;
+            if (options.packet_size != 0 && options.packet_size != 4
+                && options.packet_size != 8 && options.packet_size != 16) {
+                std::cerr << "ERROR: Packet size must be 0, 4, 8 or 16.\n";
+                print_render_usage(argv[0]);
+                exit(1);
+            }
+        } else if (std::strcmp(argv[i], "--compiled") == 0) {
+            options.compiled = true;
+        } else if (has_value && std::strcmp(argv[i], "--output") == 0) {
+            options.output = argv[++i];
+        } else if (has_value && std::strcmp(argv[i], "--format") == 0) {
+            options.format = argv[++i];
+            image_format format;
+            if (!parse_image_format(options.format, format)) {
+                std::cerr << "ERROR: Unknown image format '" << options.format << "'.\n";
+                print_render_usage(argv[0]);
+                exit(1);
+            }
+        } else if (has_value && std::strcmp(argv[i], "--adaptive") == 0) {
+            options.adaptive_error = std::max(0.0, atof(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--sample-map") == 0) {
+            options.sample_map = argv[++i];
+        } else if (std::strcmp(argv[i], "--progressive") == 0) {
+            options.progressive = true;
+        } else if (has_value && std::strcmp(argv[i], "--preview") == 0) {
+            options.preview = argv[++i];
+        } else if (has_value && std::strcmp(argv[i], "--preview-interval") == 0) {
+            options.preview_interval = std::max(0.0, atof(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--checkpoint") == 0) {
+            options.checkpoint = argv[++i];
+        } else if (has_value && std::strcmp(argv[i], "--checkpoint-interval") == 0) {
+            options.checkpoint_interval = std::max(0.0, atof(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--time-limit") == 0) {
+            options.time_limit = std::max(0.0, atof(argv[++i]));
+        } else if (has_value && std::strcmp(argv[i], "--target-error") == 0) {
+            options.target_error = std::max(0.0, atof(argv[++i]));
+        } else {
+            std::cerr << "ERROR: Unrecognized option '" << argv[i] << "'.\n";
+            print_render_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    if (options.format == "hdr" && options.output.empty()) {
+        std::cerr << "ERROR: HDR images can only be written to a file; use --output.\n";
+        exit(1);
+    }
+
+    return options;
+}
+
+
+// Ray Counting
+
+// Path rays traced by the calling thread. Integrators add one for each ray they trace, and the
+// tile renderer collects the counts after each tile, to report rays per second. A function
+// rather than a variable, so that the header can be included in more than one source file.
+inline long long& thread_rays_traced() {
+    thread_local long long count = 0;
+    return count;
+}
+
+
+// Path Termination
+
+inline bool survives_russian_roulette(color& throughput, int bounce) {
+    // Unbiased early termination of paths that can contribute little. From the fourth bounce on,
+    // a path continues with probability equal to its largest throughput component (at most 0.95),
+    // and a path that survives is weighted up by the inverse of that probability, so the
+    // expected result is unchanged.
+    const int min_bounces = 3;
+    if (bounce <= min_bounces)
+        return true;
+
+    auto q = fmin(0.95, fmax(throughput.x(), fmax(throughput.y(), throughput.z())));
+    if (!(random_double() < q))
+        return false;
+
+    throughput /= q;
+    return true;
+}
+
+
+// Tile Scheduling
+
+struct image_tile {
+    int x0, y0;  // Inclusive lower corner
+    int x1, y1;  // Exclusive upper corner
+};
+
+
+inline uint32_t morton_code(uint32_t x, uint32_t y) {
+    // Interleave the low 16 bits of x and y, x in the even bits and y in the odd bits.
+    auto spread = [](uint32_t v) -> uint32_t {
+        v &= 0x0000ffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+
+class tile_queue {
+    // A double-ended queue of tile indices. The owning worker pops from the front, while idle
+    // workers steal from the back, so that the owner keeps walking its run of neighboring tiles.
+    public:
+        void push(int tile) {
+            std::lock_guard<std::mutex> guard(lock);
+            tiles.push_back(tile);
+        }
+
+        bool pop(int& tile) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty()) return false;
+            tile = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+
+        bool steal(int& tile) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty()) return false;
+            tile = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+
+    private:
+        std::mutex lock;
+        std::deque<int> tiles;
+};
+
+
+// Tile Renderer
+
+struct accumulated_pixel {
+    // The running sums of one pixel's samples. Single precision keeps the framebuffer and its
+    // checkpoints compact; each pixel adds up a run of samples in double precision before
+    // folding them in here.
+    float sum[3];              // Sum of the sample colors
+    float luminance_squares;   // Sum of the squared sample luminances, for noise estimates
+    uint32_t count;            // Number of samples taken
+    float stopped_at;          // The stop_threshold adaptive sampling stopped it at, or 0
+
+    color total() const { return color(sum[0], sum[1], sum[2]); }
+};
+
+
+struct running_pixel {
+    // A pixel of the tile being rendered, with its running sums in double precision.
+    int i, j;
+    color sum;
+    double luminance_squares;
+    int count;
+    float stopped_at;          // As in accumulated_pixel; nonzero once adaptive sampling stops it
+};
+
+
+template <typename Hit, typename Camera, typename Trace, typename Shade>
+struct packet_pipeline {
+    // The three stages of a packet render, as given to tile_renderer::render_packets().
+    const Camera& camera_ray;
+    const Trace& trace;
+    const Shade& shade;
+};
+
+
+class tile_renderer {
+    public:
+        tile_renderer(
+            int image_width, int image_height, int samples_per_pixel,
+            const render_options& options = render_options()
+        ) : width(image_width),
+            height(image_height),
+            spp(options.samples_per_pixel > 0 ? options.samples_per_pixel : samples_per_pixel),
+            sample_limit(options.samples_per_pixel > 0),
+            tile_size(options.tile_size),
+            thread_count(options.threads),
+            scene(options.scene),
+            sampler(options.sampler),
+            packet_size(options.packet_size),
+            adaptive_error(options.adaptive_error),
+            sample_map(options.sample_map),
+            checkpoint(options.checkpoint),
+            checkpoint_interval(options.checkpoint_interval),
+            output(options.output),
+            progressive(options.progressive),
+            preview(options.preview),
+            preview_interval(options.preview_interval),
+            time_limit(options.time_limit),
+            target_error(options.target_error),
+            rays_traced(0),
+            pixels(image_width * image_height, accumulated_pixel())
+        {
+            if (thread_count <= 0)
+                thread_count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+            // A budgeted render keeps adding passes until it runs out of time or reaches its
+            // error target. It takes at most the samples per pixel given by --samples, if any,
+            // and otherwise ignores the scene's sample count.
+            budgeted = (time_limit > 0 || target_error > 0);
+            if (budgeted && !sample_limit)
+                spp = std::numeric_limits<int>::max() / 2;
+
+            // Adaptive sampling is scaled to the samples per pixel a pixel takes at most. A
+            // budget with no limit has none, so it is scaled to the scene's sample count, the
+            // one the scene was made for; the budget then decides how far past it to go.
+            auto adaptive_spp = (budgeted && !sample_limit) ? samples_per_pixel : spp;
+
+            // Adaptive sampling takes samples in batches, and checks each pixel's noise estimate
+            // between batches. The first batch must be large enough that the estimate is
+            // trustworthy, or pixels that happen to miss rare bright paths stop too early.
+            batch_size = (adaptive_error > 0)
+                       ? std::min(adaptive_spp, std::max(16, adaptive_spp / 16)) : spp;
+
+            // A pixel whose samples spread by sigma has an error of sigma/sqrt(n) after n
+            // samples. Stopping every pixel at the same error gives each n in proportion to
+            // sigma squared, which leaves the image no less noisy than spreading the same samples
+            // evenly. The image's mean squared error is lowest with n in proportion to sigma, so
+            // a pixel stops once sigma/n falls to adaptive_error/sqrt(adaptive_spp): a pixel whose
+            // error at adaptive_spp samples would be adaptive_error takes all of them.
+            stop_threshold = static_cast<float>(
+                adaptive_error / sqrt(static_cast<double>(adaptive_spp)));
+
+            if (!parse_image_format(options.format, output_format)) {
+                output_format = output.empty() ? image_format::ppm_ascii
+                                               : image_format_for_path(output);
+            }
+
+            build_tiles();
+        }
+
+        int samples_per_pixel() const { return spp; }
+
+        // The number of samples taken over the whole image. This is less than the pixel count
+        // times samples_per_pixel() when adaptive sampling stops some pixels early.
+        long long total_samples() const;
+
+        // The estimated error of the image, relative to white: the root mean square over the
+        // pixels of the standard error of their displayed values (see displayed_error()).
+        double estimated_error() const;
+
+        // Render every pixel of the image. The sample_pixel functor receives image coordinates
+        // (u,v) in [0,1] and returns the radiance of one sample through that point. It is
+        // called concurrently from all render threads, so it must not modify shared state.
+        // Each sample draws its random numbers from its own sample stream (see random.h), so
+        // the image does not depend on the number of threads or the order of the tiles.
+        //
+        // Pixels pick up from the samples they already hold, so a render resumed from a
+        // checkpoint, or continued to a higher sample count, matches one made in a single run.
+        // A progressive render makes a series of passes over the image, each raising the
+        // samples per pixel, and so shows the whole image early.
+        template <typename Sampler>
+        void render(const Sampler& sample_pixel);
+
+        // Render every pixel of the image as render() does, but trace the camera rays of
+        // neighboring pixels together, in packets of packet_size. The camera_ray functor maps
+        // image coordinates (u,v) to a camera ray. The trace functor takes a ray_packet, the
+        // mask of lanes to trace and an array of Hit records, fills in the records of the lanes
+        // that hit something and returns their mask. The shade functor takes one lane's ray, its
+        // Hit record and whether it hit, and returns the radiance of the sample.
+        //
+        // Each sample draws the same random numbers as it would under render(), so the two give
+        // the same image. The exception is a scene with objects that draw random numbers while
+        // being hit, such as constant_medium: in a packet, they draw from the stream of the
+        // packet's last sample, so the noise differs. Without a packet size, this is just
+        // render().
+        template <typename Hit, typename Camera, typename Trace, typename Shade>
+        void render_packets(const Camera& camera_ray, const Trace& trace, const Shade& shade);
+
+        // The current estimate of the image: each pixel's mean color.
+        image_buffer resolve() const;
+
+        // Write the finished image to the output file, or standard output, in the output format.
+        // Returns false if the image could not be written.
+        bool write_image();
+
+        // Write the number of samples taken in each pixel as a grayscale ASCII PPM image, where
+        // white is samples_per_pixel().
+        void write_sample_map(std::ostream& out) const;
+
+        // Save the framebuffer to a binary checkpoint file, or restore it from one. Checkpoints
+        // are written in the machine's native byte order. Both return false on failure.
+        bool save_checkpoint(const std::string& path) const;
+        bool load_checkpoint(const std::string& path);
+
+    public:
+        int width;
+        int height;
+        int spp;                          // Samples per pixel; the most, when sampling adaptively
+        bool sample_limit;                // Whether spp was given by --samples
+        bool budgeted;                    // Whether a time limit or error target ends the render
+        int tile_size;
+        int thread_count;
+        int scene;
+        sampler_type sampler;             // Sample pattern, set for every thread by render()
+        int packet_size;                  // Camera rays per packet for render_packets()
+        int batch_size;                   // Samples between adaptive noise checks
+        double adaptive_error;
+        float stop_threshold;             // Largest sigma/n at which adaptive sampling stops
+        std::string sample_map;
+        std::string checkpoint;           // Checkpoint file to resume from and save to, if any
+        double checkpoint_interval;       // Seconds between checkpoint saves
+        std::string output;               // Image file; standard output if empty
+        image_format output_format;
+        bool progressive;
+        std::string preview;              // Preview image file or shared memory object, if any
+        double preview_interval;          // Seconds between preview updates
+        double time_limit;                // Seconds to render for; 0 for no limit
+        double target_error;              // Estimated error to stop at; 0 for no target
+        long long rays_traced;            // Path rays traced by the last call to render()
+        std::vector<accumulated_pixel> pixels;  // Row-major, with row 0 at the bottom.
+        std::vector<image_tile> tiles;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        image_writer writer;
+        clock::time_point last_checkpoint;
+        clock::time_point last_preview;
+        clock::time_point render_start;
+
+        void build_tiles();
+
+        // Render every tile up to the given samples per pixel. The pass number and count are
+        // only used to report progress.
+        template <typename Sampler>
+        void render_pass(const Sampler& sample_pixel, int target, int pass, int pass_count);
+
+        // Called under the progress lock after each tile, to save checkpoints and publish
+        // previews when they are due.
+        void tile_finished();
+
+        // Queue the current image for the preview, warning if an earlier preview failed.
+        void submit_preview();
+
+        // The samples per pixel to add in the next budgeted pass.
+        int pass_increment(int target, long long samples_before) const;
+        bool out_of_time() const;
+
+        // Whether adaptive sampling stopped the pixel at this render's threshold or a lower one.
+        // A pixel stopped by a render that aimed for more noise picks up where it left off.
+        bool stopped(const accumulated_pixel& pixel) const;
+
+        // Stop the tile pixels that hold s samples and are quiet enough. Each pixel is judged by
+        // the larger of its own noise and the mean noise of its 3x3 neighborhood in the tile, as
+        // a single pixel's estimate is unreliable where rare bright paths dominate.
+        void stop_converged(const image_tile& tile, int s, std::vector<running_pixel>& running)
+            const;
+
+        // Render a tile into out, which holds one entry per tile pixel, in rows from the top.
+        // The tile's pixels take their samples together, batch by batch, and sample_batch
+        // takes samples s to batch_end of every pixel in running that holds s and has not
+        // stopped.
+        template <typename Batch>
+        void render_tile_batches(
+            const image_tile& tile, int target, accumulated_pixel* out,
+            const Batch& sample_batch) const;
+
+        template <typename Sampler>
+        void render_tile(
+            const image_tile& tile, const Sampler& sample_pixel, int target,
+            accumulated_pixel* out) const;
+
+        template <typename Hit, typename Camera, typename Trace, typename Shade>
+        void render_tile(
+            const image_tile& tile, const packet_pipeline<Hit, Camera, Trace, Shade>& pipeline,
+            int target, accumulated_pixel* out) const;
+};
+
+
+struct checkpoint_header {
+    char     magic[8];     // "RTWCKPT\0"
+    uint32_t version;
+    uint32_t pixel_size;   // sizeof(accumulated_pixel), to catch incompatible builds
+    int32_t  width;
+    int32_t  height;
+    int32_t  scene;
+    int32_t  sampler;      // The sampler_type, and the seed of the sample streams, so that a
+    uint64_t seed;         // resumed render draws the same samples as one made in a single run
+};
+
+
+void tile_renderer::build_tiles() {
+    int tiles_x = (width  + tile_size - 1) / tile_size;
+    int tiles_y = (height + tile_size - 1) / tile_size;
+
+    struct keyed_tile {
+        uint32_t key;
+        image_tile tile;
+    };
+
+    std::vector<keyed_tile> keyed;
+    keyed.reserve(tiles_x * tiles_y);
+
+    // Tile rows are numbered from the top of the image, where the output stream starts.
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            image_tile tile;
+            tile.x0 = tx * tile_size;
+            tile.x1 = std::min(width, tile.x0 + tile_size);
+            tile.y1 = height - ty * tile_size;
+            tile.y0 = std::max(0, tile.y1 - tile_size);
+            keyed.push_back({morton_code(tx, ty), tile});
+        }
+    }
+
+    // Visit tiles in Morton order, so that consecutive tiles (and consecutive runs of tiles
+    // handed to each worker) stay spatially close and share the same parts of the scene.
+    std::sort(keyed.begin(), keyed.end(),
+        [](const keyed_tile& a, const keyed_tile& b) { return a.key < b.key; });
+
+    tiles.clear();
+    for (const auto& k : keyed)
+        tiles.push_back(k.tile);
+}
+
+
+template <typename Sampler>
+void tile_renderer::render(const Sampler& sample_pixel) {
+    // Resume from an existing checkpoint. One that cannot be used stops the render, rather than
+    // being overwritten by the next save.
+    if (!checkpoint.empty() && std::ifstream(checkpoint)) {
+        if (!load_checkpoint(checkpoint))
+            exit(1);
+        std::cerr << "Resuming from checkpoint '" << checkpoint << "' with "
+                  << total_samples() << " samples.\n";
+    }
+
+    // A preview file that cannot be written is caught here, once, rather than at every update.
+    // Previews are only a convenience, so the render goes on without them.
+    if (!preview.empty() && preview.compare(0, 4, "shm:") != 0
+        && !std::ofstream(preview, std::ios::binary | std::ios::app)) {
+        std::cerr << "WARNING: Cannot write the preview to '" << preview
+                  << "'. Rendering without previews.\n";
+        preview.clear();
+    }
+
+    auto workers = std::min(thread_count, std::max(1, static_cast<int>(tiles.size())));
+    std::cerr << "Rendering " << width << 'x' << height;
+    if (budgeted) {
+        if (time_limit > 0)
+            std::cerr << " for up to " << time_limit << " seconds";
+        if (target_error > 0)
+            std::cerr << (time_limit > 0 ? " or" : "")
+                      << " until the estimated error is below " << target_error;
+        if (sample_limit)
+            std::cerr << ", at most " << spp << " samples per pixel,";
+    } else {
+        std::cerr << " at " << spp << " samples per pixel";
+    }
+    std::cerr << " on " << workers << " threads.\n";
+
+    active_sampler() = sampler;
+    render_start = clock::now();
+    last_checkpoint = last_preview = render_start;
+    rays_traced = 0;
+    auto samples_before = total_samples();
+
+    // Progressive and budgeted passes double the samples per pixel, so the passes before the
+    // last add up to no more than the last one.
+    int pass_count = 1;
+    if (budgeted)
+        pass_count = 0;
+    else if (progressive)
+        for (int target = 1; target < spp; target *= 2)
+            pass_count++;
+
+    int target = 0;
+    for (int pass = 1; target < spp && !out_of_time(); pass++) {
+        if (!budgeted && !progressive)
+            target = spp;
+        else if (target == 0)
+            target = 1;
+        else
+            target = std::min(spp, target + pass_increment(target, samples_before));
+
+        render_pass(sample_pixel, target, pass, pass_count);
+
+        if (!preview.empty()) {
+            submit_preview();
+            last_preview = clock::now();
+        }
+
+        // With only a few samples, most pixels have not yet seen their rare bright paths, so
+        // the error estimate is far too low to trust.
+        const int fewest_samples_for_estimate = 16;
+        if (target_error > 0 && target >= fewest_samples_for_estimate
+            && estimated_error() <= target_error)
+            break;
+    }
+
+    if (budgeted)
+        spp = target;
+
+    if (!checkpoint.empty() && !save_checkpoint(checkpoint))
+        std::cerr << "\nERROR: Could not save the checkpoint '" << checkpoint << "'.\n";
+
+    auto seconds = std::chrono::duration<double>(clock::now() - render_start).count();
+    auto samples = total_samples() - samples_before;
+    std::cerr << "\nRendered " << samples << " samples in " << seconds << " seconds ("
+              << static_cast<double>(total_samples()) / pixels.size() << " per pixel): "
+              << samples / seconds / 1e6 << " Msamples/s, "
+              << rays_traced / seconds / 1e6 << " Mrays/s, estimated error "
+              << estimated_error() << ".\n";
+
+    if (adaptive_error > 0) {
+        auto full = static_cast<double>(width) * height * spp;
+        std::cerr << "Adaptive sampling took " << total_samples() << " samples, "
+                  << 100.0 * total_samples() / full << "% of " << spp << " per pixel.\n";
+    }
+
+    if (!sample_map.empty()) {
+        std::ofstream out(sample_map);
+        if (out)
+            write_sample_map(out);
+        else
+            std::cerr << "ERROR: Could not write the sample map '" << sample_map << "'.\n";
+    }
+}
+
+
+template <typename Hit, typename Camera, typename Trace, typename Shade>
+void tile_renderer::render_packets(
+    const Camera& camera_ray, const Trace& trace, const Shade& shade
+) {
+    if (packet_size < 2) {
+        render([&](double u, double v) {
+            ray r = camera_ray(u, v);
+            return shade(r, nullptr, false);
+        });
+        return;
+    }
+
+    std::cerr << "Tracing camera rays in packets of " << packet_size << ".\n";
+    render(packet_pipeline<Hit, Camera, Trace, Shade>{camera_ray, trace, shade});
+}
+
+
+int tile_renderer::pass_increment(int target, long long samples_before) const {
+    // Normally each pass doubles the samples per pixel. Under a time limit, the last pass is cut
+    // down to what the rate so far says will fit in the remaining time, so that the render does
+    // not stop partway through a pass, leaving some tiles with half the samples of others.
+    auto increment = target;
+    if (time_limit <= 0)
+        return increment;
+
+    auto elapsed = std::chrono::duration<double>(clock::now() - render_start).count();
+    auto rendered = static_cast<double>(total_samples() - samples_before) / pixels.size();
+    if (elapsed <= 0 || rendered <= 0)
+        return increment;
+
+    auto fits = (time_limit - elapsed) / (elapsed / rendered);
+    return std::max(1, static_cast<int>(std::min(static_cast<double>(increment), fits)));
+}
+
+
+bool tile_renderer::out_of_time() const {
+    auto elapsed = std::chrono::duration<double>(clock::now() - render_start).count();
+    return time_limit > 0 && elapsed >= time_limit;
+}
+
+
+template <typename Sampler>
+void tile_renderer::render_pass(const Sampler& sample_pixel, int target, int pass, int pass_count) {
+    int tile_count = static_cast<int>(tiles.size());
+    int workers = std::min(thread_count, std::max(1, tile_count));
+
+    // Deal each worker one contiguous run of the Morton-ordered tiles. Workers that run dry
+    // steal from the far end of another worker's run.
+    std::vector<tile_queue> queues(workers);
+    for (int w = 0; w < workers; w++) {
+        auto begin = static_cast<long>(tile_count) * w / workers;
+        auto end   = static_cast<long>(tile_count) * (w+1) / workers;
+        for (auto t = begin; t < end; t++)
+            queues[w].push(static_cast<int>(t));
+    }
+
+    std::mutex progress_lock;
+    int tiles_remaining = tile_count;
+
+    auto worker = [&](int id) {
+        // Tiles are rendered into a private buffer, then copied into the framebuffer under the
+        // lock, so checkpoints and previews never see a tile half done.
+        std::vector<accumulated_pixel> tile_pixels(tile_size * tile_size);
+
+        int tile;
+        while (!out_of_time()) {
+            if (!queues[id].pop(tile)) {
+                bool stolen = false;
+                for (int k = 1; k < workers && !stolen; k++)
+                    stolen = queues[(id + k) % workers].steal(tile);
+                if (!stolen)
+                    return;
+            }
+
+            const auto& t = tiles[tile];
+            render_tile(t, sample_pixel, target, tile_pixels.data());
+
+            std::lock_guard<std::mutex> guard(progress_lock);
+
+            auto in = tile_pixels.begin();
+            for (int j = t.y1-1; j >= t.y0; --j)
+                for (int i = t.x0; i < t.x1; ++i)
+                    pixels[j*width + i] = *in++;
+
+            rays_traced += thread_rays_traced();
+            thread_rays_traced() = 0;
+
+            --tiles_remaining;
+            std::cerr << '\r';
+            if (pass_count != 1) {
+                std::cerr << "Pass " << pass;
+                if (pass_count > 1)
+                    std::cerr << " of " << pass_count;
+                std::cerr << " (" << target << " spp), ";
+            }
+            std::cerr << "Tiles remaining: " << tiles_remaining << ' ' << std::flush;
+
+            if (tiles_remaining > 0)
+                tile_finished();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int w = 1; w < workers; w++)
+        threads.emplace_back(worker, w);
+
+    worker(0);
+
+    for (auto& thread : threads)
+        thread.join();
+}
+
+
+void tile_renderer::tile_finished() {
+    auto now = clock::now();
+    auto seconds_since = [now](clock::time_point then) {
+        return std::chrono::duration<double>(now - then).count();
+    };
+
+    if (!checkpoint.empty() && seconds_since(last_checkpoint) >= checkpoint_interval) {
+        if (!save_checkpoint(checkpoint))
+            std::cerr << "\nERROR: Could not save the checkpoint '" << checkpoint << "'.\n";
+        last_checkpoint = now;
+    }
+
+    // Copying out the image holds up the other workers only briefly. The writer thread does the
+    // slow part, the encoding.
+    if (!preview.empty() && seconds_since(last_preview) >= preview_interval) {
+        submit_preview();
+        last_preview = now;
+    }
+}
+
+
+void tile_renderer::submit_preview() {
+    // The writer only ever holds previews until the final image, so a failure it reports here
+    // belongs to an earlier preview.
+    if (writer.clear_failure())
+        std::cerr << "\nWARNING: Could not write the preview to '" << preview << "'.\n";
+
+    writer.submit(resolve(), preview, image_format_for_path(preview));
+}
+
+
+template <typename Batch>
+void tile_renderer::render_tile_batches(
+    const image_tile& tile, int target, accumulated_pixel* out, const Batch& sample_batch
+) const {
+    std::vector<running_pixel> running;
+    running.reserve((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+    for (int j = tile.y1-1; j >= tile.y0; --j) {
+        for (int i = tile.x0; i < tile.x1; ++i) {
+            const auto& pixel = pixels[j*width + i];
+            auto stopped_at = stopped(pixel) ? pixel.stopped_at : 0;
+            running.push_back({i, j, pixel.total(), pixel.luminance_squares,
+                               static_cast<int>(pixel.count), stopped_at});
+        }
+    }
+
+    // Without adaptive sampling, one batch covers every sample. The stopping test only runs at
+    // multiples of the batch size, when every pixel still sampling holds the same samples, so
+    // the result does not depend on the passes or on where an earlier run left off.
+    while (true) {
+        auto s = target;
+        for (const auto& pixel : running)
+            if (pixel.stopped_at == 0)
+                s = std::min(s, pixel.count);
+        if (s >= target)
+            break;
+
+        if (adaptive_error > 0 && s > 0 && s % batch_size == 0)
+            stop_converged(tile, s, running);
+
+        sample_batch(running, s, std::min(target, (s / batch_size + 1) * batch_size));
+    }
+
+    for (const auto& pixel : running) {
+        for (int a = 0; a < 3; a++)
+            out->sum[a] = static_cast<float>(pixel.sum[a]);
+        out->luminance_squares = static_cast<float>(pixel.luminance_squares);
+        out->count = static_cast<uint32_t>(pixel.count);
+        out->stopped_at = pixel.stopped_at;
+        out++;
+    }
+
+    end_sample_stream();
+}
+
+
+template <typename Sampler>
+void tile_renderer::render_tile(
+    const image_tile& tile, const Sampler& sample_pixel, int target, accumulated_pixel* out
+) const {
+    auto sample_batch = [&](std::vector<running_pixel>& running, int s, int batch_end) {
+        for (auto& pixel : running) {
+            if (pixel.stopped_at != 0 || pixel.count != s)
+                continue;
+
+            for (; pixel.count < batch_end; pixel.count++) {
+                begin_sample_stream(pixel.i, pixel.j, pixel.count);
+                double jitter_u, jitter_v;
+                random_double_pair(jitter_u, jitter_v);
+                auto u = (pixel.i + jitter_u) / (width-1);
+                auto v = (pixel.j + jitter_v) / (height-1);
+                auto sample = sample_pixel(u, v);
+                pixel.sum += sample;
+
+                auto y = luminance(sample);
+                if (y == y)
+                    pixel.luminance_squares += y*y;
+            }
+        }
+    };
+
+    render_tile_batches(tile, target, out, sample_batch);
+}
+
+
+template <typename Hit, typename Camera, typename Trace, typename Shade>
+void tile_renderer::render_tile(
+    const image_tile& tile, const packet_pipeline<Hit, Camera, Trace, Shade>& pipeline,
+    int target, accumulated_pixel* out
+) const {
+    // Each packet covers a block of neighboring pixels, 2x2, 4x2 or 4x4, whose camera rays
+    // mostly visit the same BVH nodes. Every pixel takes its samples in the same order and from
+    // the same sample streams as in the other render_tile(), and stops at the same batch
+    // boundaries, so the two give the same image. A pixel that is not sampling in this batch is
+    // left out of the packet's mask.
+    auto block_width = (packet_size >= 8) ? 4 : 2;
+    auto block_height = packet_size / block_width;
+    auto tile_width = tile.x1 - tile.x0;
+    auto tile_height = tile.y1 - tile.y0;
+
+    auto sample_batch = [&](std::vector<running_pixel>& running, int s, int batch_end) {
+        for (int block_y = 0; block_y < tile_height; block_y += block_height) {
+            for (int block_x = 0; block_x < tile_width; block_x += block_width) {
+                running_pixel* lanes[ray_packet::max_size];
+                int lane_count = 0;
+                unsigned active = 0;
+
+                for (int y = block_y; y < std::min(tile_height, block_y + block_height); ++y) {
+                    for (int x = block_x; x < std::min(tile_width, block_x + block_width); ++x) {
+                        auto& pixel = running[y*tile_width + x];
+                        if (pixel.stopped_at == 0 && pixel.count == s)
+                            active |= 1u << lane_count;
+                        lanes[lane_count++] = &pixel;
+                    }
+                }
+                if (!active)
+                    continue;
+
+                ray_packet rays;
+                rays.size = lane_count;
+                Hit hits[ray_packet::max_size];
+
+                for (int n = s; n < batch_end; n++) {
+                    for (int k = 0; k < lane_count; k++) {
+                        if (!((active >> k) & 1))
+                            continue;
+                        const auto& lane = *lanes[k];
+                        begin_sample_stream(lane.i, lane.j, n);
+                        double jitter_u, jitter_v;
+                        random_double_pair(jitter_u, jitter_v);
+                        auto u = (lane.i + jitter_u) / (width-1);
+                        auto v = (lane.j + jitter_v) / (height-1);
+                        rays.set(k, pipeline.camera_ray(u, v));
+                    }
+
+                    auto found = pipeline.trace(rays, active, hits);
+
+                    // Shading picks up each sample stream where the camera ray left it: the
+                    // first bounce starts at its own dimensions, whatever the camera drew.
+                    for (int k = 0; k < lane_count; k++) {
+                        if (!((active >> k) & 1))
+                            continue;
+                        auto& lane = *lanes[k];
+                        begin_sample_stream(lane.i, lane.j, n);
+                        auto hit = ((found >> k) & 1) != 0;
+                        auto sample = pipeline.shade(rays.get(k), &hits[k], hit);
+                        lane.sum += sample;
+
+                        auto y = luminance(sample);
+                        if (y == y)
+                            lane.luminance_squares += y*y;
+                        lane.count++;
+                    }
+                }
+            }
+        }
+    };
+
+    render_tile_batches(tile, target, out, sample_batch);
+}
+
+
+inline double displayed_error(double n, double luminance_sum, double luminance_squares) {
+    // Estimates the standard error of a pixel's mean luminance from the running sums of n
+    // samples, then maps it through the display transform, as a fraction of white: gamma 2
+    // makes errors in dark pixels show more, and clamping hides errors in pixels brighter than
+    // white. The error is half the displayed width of the interval one standard error either
+    // side of the mean, so that a pixel pushed past white by one bright path still counts as
+    // noisy.
+    auto mean = luminance_sum / n;
+    auto variance = std::max(0.0, (luminance_squares - luminance_sum*mean) / (n-1));
+    auto error = sqrt(variance / n);
+
+    auto display = [](double y) { return sqrt(clamp(y, 0.0, 1.0)); };
+    return (display(mean + error) - display(mean - error)) / 2;
+}
+
+
+bool tile_renderer::stopped(const accumulated_pixel& pixel) const {
+    return adaptive_error > 0 && pixel.stopped_at > 0 && pixel.stopped_at <= stop_threshold;
+}
+
+
+void tile_renderer::stop_converged(
+    const image_tile& tile, int s, std::vector<running_pixel>& running
+) const {
+    auto tile_width = tile.x1 - tile.x0;
+    auto tile_height = tile.y1 - tile.y0;
+
+    // The spread of each pixel's displayed samples: its displayed error times the square root
+    // of its samples. Pixels with too few samples, or with NaN sums, have none.
+    std::vector<double> spread(running.size(), -1);
+    for (size_t k = 0; k < running.size(); k++) {
+        const auto& pixel = running[k];
+        if (pixel.count < 2)
+            continue;
+        auto n = static_cast<double>(pixel.count);
+        auto error = displayed_error(n, luminance(pixel.sum), pixel.luminance_squares);
+        if (error == error)
+            spread[k] = error * sqrt(n);
+    }
+
+    for (int y = 0; y < tile_height; y++) {
+        for (int x = 0; x < tile_width; x++) {
+            auto& pixel = running[y*tile_width + x];
+            auto own = spread[y*tile_width + x];
+            if (pixel.stopped_at != 0 || pixel.count != s || own < 0)
+                continue;
+
+            double total = 0;
+            int counted = 0;
+            for (int ny = std::max(0, y-1); ny <= std::min(tile_height-1, y+1); ny++) {
+                for (int nx = std::max(0, x-1); nx <= std::min(tile_width-1, x+1); nx++) {
+                    if (spread[ny*tile_width + nx] >= 0) {
+                        total += spread[ny*tile_width + nx];
+                        counted++;
+                    }
+                }
+            }
+
+            if (std::max(own, total / counted) / s <= stop_threshold)
+                pixel.stopped_at = stop_threshold;
+        }
+    }
+}
+
+
+long long tile_renderer::total_samples() const {
+    long long total = 0;
+    for (const auto& pixel : pixels)
+        total += pixel.count;
+    return total;
+}
+
+
+double tile_renderer::estimated_error() const {
+    double squares = 0;
+    long long counted = 0;
+
+    for (const auto& pixel : pixels) {
+        if (pixel.count < 2)
+            continue;
+
+        auto error = displayed_error(
+            pixel.count, luminance(pixel.total()), pixel.luminance_squares);
+        if (error == error) {
+            squares += error*error;
+            counted++;
+        }
+    }
+
+    return (counted > 0) ? sqrt(squares / counted) : infinity;
+}
+
+
+image_buffer tile_renderer::resolve() const {
+    image_buffer image;
+    image.width = width;
+    image.height = height;
+    image.rgb.resize(3 * pixels.size());
+    image.samples = static_cast<uint64_t>(total_samples());
+
+    auto out = image.rgb.begin();
+    for (int j = height-1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            const auto& pixel = pixels[j*width + i];
+            auto scale = 1.0f / std::max(1u, pixel.count);
+            for (int a = 0; a < 3; a++)
+                *out++ = pixel.sum[a] * scale;
+        }
+    }
+
+    return image;
+}
+
+
+bool tile_renderer::write_image() {
+    // Let any preview still being written finish first, so that its result is not taken for
+    // the final image's.
+    writer.finish();
+    if (writer.clear_failure())
+        std::cerr << "WARNING: Could not write the preview to '" << preview << "'.\n";
+
+    writer.submit(resolve(), output, output_format);
+    writer.finish();
+
+    if (writer.clear_failure()) {
+        std::cerr << "ERROR: Could not write the image to '"
+                  << (output.empty() ? "standard output" : output) << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+
+void tile_renderer::write_sample_map(std::ostream& out) const {
+    out << "P3\n" << width << ' ' << height << "\n255\n";
+
+    for (int j = height-1; j >= 0; --j) {
+        for (int i = 0; i < width; ++i) {
+            auto count = static_cast<double>(pixels[j*width + i].count);
+            auto level = static_cast<int>(fmin(255.0, 255.0 * count / spp + 0.5));
+            out << level << ' ' << level << ' ' << level << '\n';
+        }
+    }
+}
+
+
+bool tile_renderer::save_checkpoint(const std::string& path) const {
+    checkpoint_header header = {
+        {'R','T','W','C','K','P','T','\0'}, 3, sizeof(accumulated_pixel), width, height, scene,
+        static_cast<int32_t>(sampler), random_seed_base().load()
+    };
+
+    // Write to a temporary file and then rename it over the old checkpoint, so that a render
+    // killed while saving still leaves the previous checkpoint intact.
+    auto temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(pixels.data()),
+                  static_cast<std::streamsize>(pixels.size() * sizeof(accumulated_pixel)));
+        if (!out)
+            return false;
+    }
+
+    return replace_file(temporary, path);
+}
+
+
+bool tile_renderer::load_checkpoint(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    checkpoint_header header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    if (!in || std::memcmp(header.magic, "RTWCKPT", 8) != 0 || header.version != 3
+        || header.pixel_size != sizeof(accumulated_pixel)) {
+        std::cerr << "ERROR: '" << path << "' is not a checkpoint from this program.\n";
+        return false;
+    }
+
+    if (header.width != width || header.height != height || header.scene != scene) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' is for a different image or scene.\n";
+        return false;
+    }
+
+    if (header.sampler != static_cast<int32_t>(sampler)
+        || header.seed != random_seed_base().load()) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' was rendered with a different sampler"
+                  << " or seed.\n";
+        return false;
+    }
+
+    std::vector<accumulated_pixel> loaded(pixels.size());
+    in.read(reinterpret_cast<char*>(loaded.data()),
+            static_cast<std::streamsize>(loaded.size() * sizeof(accumulated_pixel)));
+    if (!in) {
+        std::cerr << "ERROR: Checkpoint '" << path << "' is truncated.\n";
+        return false;
+    }
+
+    pixels.swap(loaded);
+    return true;
+}
+
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef RTWEEKEND_STB_IMAGE_WRITE_H
+#define RTWEEKEND_STB_IMAGE_WRITE_H
+
+
+// Disable pedantic warnings for this external library.
+#ifdef _MSC_VER
+    // Microsoft Visual C++ Compiler
+    #pragma warning (push, 0)
+#elif defined(__GNUC__)
+    // GCC and Clang
+    #pragma GCC diagnostic push
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+    #ifndef __clang__
+        #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+    #endif
+#endif
+
+
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "external/stb_image_write.h"
+
+
+// Restore warning levels.
+#ifdef _MSC_VER
+    // Microsoft Visual C++ Compiler
+    #pragma warning (pop)
+#elif defined(__GNUC__)
+    // GCC and Clang
+    #pragma GCC diagnostic pop
+#endif
+
+#endif
@@ -14,6 +14,8 @@
 #include <limits>
 #include <memory>
 
+#include "sampler.h"
+
 
 // Usings
 
@@ -39,8 +41,18 @@ inline double clamp(double x, double min, double max) {
 }
 
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1), drawn from the calling thread's current sample stream.
+    return random_unit_double(next_random_bits());
+}
+
+inline void random_double_pair(double& u, double& v) {
+    // Returns two random reals in [0,1) that together form one 2D sample, such as a point on a
+    // disk or a direction. Samplers stratify the pair jointly, so use this rather than two calls
+    // to random_double() whenever the two values are mapped together.
+    uint64_t first, second;
+    next_random_pair(first, second);
+    u = random_unit_double(first);
+    v = random_unit_double(second);
 }
 
 inline double random_double(double min, double max) {
@@ -50,7 +62,9 @@ inline double random_double(double min, double max) {
 
 inline int random_int(int min, int max) {
     // Returns a random integer in [min,max].
-    return static_cast<int>(random_double(min, max+1));
+    auto range = static_cast<uint64_t>(static_cast<int64_t>(max) - min + 1);
+    return static_cast<int>(min + static_cast<int64_t>(
+        ((next_random_bits() >> 32) * range) >> 32));
 }
 
 // Common Headers
@@ -0,0 +1,399 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include "random.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Samplers
+//
+// A sampler decides the value of each dimension of each pixel sample in a sample stream. The
+// independent sampler hashes every dimension separately, as if drawing from a generator. The
+// others spread the samples of a pixel evenly over each dimension, and over each pair of
+// dimensions drawn together (see next_random_pair), so that estimates converge faster than
+// with independent samples.
+
+enum class sampler_type {
+    independent,  // Uncorrelated hashed values
+    sobol,        // Owen-scrambled Sobol points, padded by pairs of dimensions
+    halton,       // Halton points with random digit scrambling per pixel
+    blue_noise    // Sobol points shifted by a blue noise mask, so errors look like blue noise
+};
+
+
+inline bool parse_sampler_type(const std::string& name, sampler_type& type) {
+    if      (name == "independent") type = sampler_type::independent;
+    else if (name == "sobol")       type = sampler_type::sobol;
+    else if (name == "halton")      type = sampler_type::halton;
+    else if (name == "blue-noise")  type = sampler_type::blue_noise;
+    else return false;
+    return true;
+}
+
+
+inline sampler_type& active_sampler() {
+    // The sampler used by every sample stream. Set it before rendering starts.
+    static sampler_type type = sampler_type::sobol;
+    return type;
+}
+
+
+// Bit Twiddling
+
+inline uint32_t reverse_bits(uint32_t x) {
+    #if defined(__GNUC__)
+        x = __builtin_bswap32(x);
+    #else
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    #endif
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+
+inline uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+    // Burley's hash ("Practical Hash-based Owen Scrambling", 2020). Each bit of the result
+    // depends only on the same bit and the bits below it, so applied to a bit-reversed fraction
+    // it is an Owen scramble: each digit is flipped or not depending only on the digits above
+    // it, and a stratified set of values stays stratified.
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+
+// Sobol Points
+
+inline void sobol_pair(uint32_t index, uint64_t seed, uint32_t& first, uint32_t& second) {
+    // A point of the 2D Sobol sequence, as 32-bit fractions. The seed shuffles the order of the
+    // points and Owen-scrambles their values, so that every pair of dimensions gets its own
+    // independent, well-stratified point set.
+    //
+    // The work is done on bit-reversed fractions, where the Owen scramble is a single hash. The
+    // first Sobol dimension, the base 2 van der Corput sequence, is the index itself in that
+    // form. The second has the Pascal matrix mod 2 as its generator matrix, in which entry (i,j)
+    // is set when the bits of i are a subset of those of j (Lucas' theorem), so its reversed
+    // digit i is the parity of the index bits at every superset of i.
+    auto shuffled = reverse_bits(laine_karras_permutation(reverse_bits(index),
+                                                          static_cast<uint32_t>(seed)));
+
+    auto pascal = shuffled;
+    pascal ^= (pascal >>  1) & 0x55555555u;
+    pascal ^= (pascal >>  2) & 0x33333333u;
+    pascal ^= (pascal >>  4) & 0x0f0f0f0fu;
+    pascal ^= (pascal >>  8) & 0x00ff00ffu;
+    pascal ^= (pascal >> 16) & 0x0000ffffu;
+
+    auto first_seed = static_cast<uint32_t>(seed >> 32);
+    auto second_seed = first_seed * 0x9e3779b9u + 0x7f4a7c15u;
+    first  = reverse_bits(laine_karras_permutation(shuffled, first_seed));
+    second = reverse_bits(laine_karras_permutation(pascal, second_seed));
+}
+
+
+// Halton Points
+
+inline uint32_t permute_digit(uint32_t i, uint32_t length, uint32_t seed) {
+    // Kensler's hashed permutation ("Correlated Multi-Jittered Sampling", 2013): element i of
+    // a random permutation of [0, length) chosen by the seed. It permutes the next power of two
+    // and walks the cycle until it lands back in range.
+    uint32_t mask = length - 1;
+    mask |= mask >> 1;
+    mask |= mask >> 2;
+    mask |= mask >> 4;
+    mask |= mask >> 8;
+    mask |= mask >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & mask) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & mask) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & mask) >> 2;
+        i *= 0xc860a3dfu;
+        i &= mask;
+        i ^= i >> 5;
+    } while (i >= length);
+    return (i + seed) % length;
+}
+
+
+inline double scrambled_radical_inverse(uint32_t base, uint64_t index, uint64_t seed) {
+    // Mirrors the base-b digits of index about the radix point, after an Owen scramble: each
+    // digit goes through a random permutation chosen by the digits before it. The points stay
+    // stratified in every base-b interval, and the dimensions lose the correlations of plain
+    // Halton points, which in large bases lie nearly on the same line for the first samples.
+    if (base == 2) {
+        auto bits = reverse_bits(laine_karras_permutation(static_cast<uint32_t>(index),
+                                                          static_cast<uint32_t>(seed)));
+        return bits * (1.0 / 4294967296.0);
+    }
+
+    // Leading zero digits are scrambled too, down to intervals of 1/4096 or smaller, so that
+    // samples are stratified at least that finely however few digits their index has.
+    auto inverse_base = 1.0 / base;
+    auto scale = 1.0;
+    auto state = seed;
+    auto remaining = static_cast<uint32_t>(index);
+    double result = 0;
+    while (remaining != 0 || scale > 1.0 / 4096) {
+        auto digit = remaining % base;
+        remaining /= base;
+        scale *= inverse_base;
+        result += permute_digit(digit, base, static_cast<uint32_t>(state)) * scale;
+        state = hash64(state + 0x9e3779b97f4a7c15ull * (digit + 1));
+    }
+
+    // The digits past those are scrambled as well, which places the point uniformly at random
+    // within its final interval.
+    result += random_unit_double(hash64(state)) * scale;
+    return std::min(result, 0.99999999999999989);
+}
+
+
+const int halton_dimensions_per_bounce = 8;
+const int halton_dimension_count = 32;
+
+inline uint32_t halton_prime(int dimension) {
+    static const uint32_t primes[halton_dimension_count] = {
+          2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+         59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131
+    };
+    return primes[dimension];
+}
+
+
+// Blue Noise
+
+const int blue_noise_size = 64;  // Edge length of the blue noise mask, a power of two
+
+inline std::vector<uint16_t> make_blue_noise_mask() {
+    // Ranks the pixels of a tiling square by Ulichney's void-and-cluster method, so that the
+    // pixels of any rank and below are spread evenly, with no low-frequency clumps or gaps.
+    const int size = blue_noise_size;
+    const int count = size * size;
+    const double sigma = 1.5;
+
+    // The energy of a pixel is the sum of a Gaussian of its wrapped distance to each set pixel.
+    std::vector<double> kernel(count);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            auto dx = std::min(x, size - x);
+            auto dy = std::min(y, size - y);
+            kernel[y*size + x] = std::exp(-(dx*dx + dy*dy) / (2*sigma*sigma));
+        }
+    }
+
+    std::vector<char> set(count, 0);
+    std::vector<double> energy(count, 0.0);
+
+    auto toggle = [&](int p) {
+        set[p] = !set[p];
+        auto sign = set[p] ? 1.0 : -1.0;
+        auto px = p % size;
+        auto py = p / size;
+        for (int y = 0; y < size; y++) {
+            auto kernel_row = &kernel[((y - py) & (size-1)) * size];
+            for (int x = 0; x < size; x++)
+                energy[y*size + x] += sign * kernel_row[(x - px) & (size-1)];
+        }
+    };
+
+    auto tightest_cluster = [&]() -> int {
+        int best = -1;
+        for (int p = 0; p < count; p++)
+            if (set[p] && (best < 0 || energy[p] > energy[best]))
+                best = p;
+        return best;
+    };
+
+    auto largest_void = [&]() -> int {
+        int best = -1;
+        for (int p = 0; p < count; p++)
+            if (!set[p] && (best < 0 || energy[p] < energy[best]))
+                best = p;
+        return best;
+    };
+
+    // Start from a tenth of the pixels, chosen at random, and even them out by moving the pixel
+    // in the tightest cluster to the largest void until that pixel would move straight back.
+    xoshiro256 generator(0xb1e5);
+    int initial_count = count / 10;
+    for (int placed = 0; placed < initial_count; ) {
+        auto p = static_cast<int>(generator.next() % count);
+        if (!set[p]) {
+            toggle(p);
+            placed++;
+        }
+    }
+
+    while (true) {
+        auto cluster = tightest_cluster();
+        toggle(cluster);
+        auto gap = largest_void();
+        toggle(gap);
+        if (gap == cluster)
+            break;
+    }
+
+    auto initial_set = set;
+    auto initial_energy = energy;
+    std::vector<uint16_t> ranks(count);
+
+    // Rank the initial pixels by removing the tightest cluster, one pixel at a time.
+    for (int rank = initial_count - 1; rank >= 0; rank--) {
+        auto cluster = tightest_cluster();
+        toggle(cluster);
+        ranks[cluster] = static_cast<uint16_t>(rank);
+    }
+
+    // Rank the rest by filling the largest void, one pixel at a time.
+    set = initial_set;
+    energy = initial_energy;
+    for (int rank = initial_count; rank < count; rank++) {
+        auto gap = largest_void();
+        toggle(gap);
+        ranks[gap] = static_cast<uint16_t>(rank);
+    }
+
+    return ranks;
+}
+
+
+inline const std::vector<uint16_t>& blue_noise_mask() {
+    // Built on first use; takes a few tens of milliseconds.
+    static const std::vector<uint16_t> mask = make_blue_noise_mask();
+    return mask;
+}
+
+
+// Sample Values
+
+inline uint64_t halton_sample_bits(const sample_stream& stream, uint64_t halton_dimension) {
+    auto prime = halton_prime(static_cast<int>(halton_dimension));
+    auto seed = hash64(stream.pixel_key + 0x9e3779b97f4a7c15ull * (halton_dimension + 1));
+    auto value = scrambled_radical_inverse(prime, stream.sample_index, seed);
+    return static_cast<uint64_t>(value * 18446744073709551616.0);
+}
+
+
+inline void sample_pair_bits(
+    const sample_stream& stream, uint64_t pair, uint64_t& first, uint64_t& second
+) {
+    // Returns the values of dimensions 2*pair and 2*pair+1 of the stream's current sample, as
+    // the high bits of 64-bit integers. Samplers build their points a pair of dimensions at a
+    // time, so computing both costs little more than one; a caller after a single value leaves
+    // the other unused, and inlining drops its computation.
+    auto counter = (stream.bounce << 32) | pair;
+
+    switch (active_sampler()) {
+        case sampler_type::sobol: {
+            auto seed = hash64(stream.pixel_key + 0x9e3779b97f4a7c15ull * (counter + 1));
+            uint32_t u, v;
+            sobol_pair(static_cast<uint32_t>(stream.sample_index), seed, u, v);
+            first  = uint64_t(u) << 32;
+            second = uint64_t(v) << 32;
+            return;
+        }
+
+        case sampler_type::halton: {
+            // Dimensions past the table of primes are drawn independently.
+            auto dimension = 2*pair;
+            auto halton_dimension = stream.bounce * halton_dimensions_per_bounce + dimension;
+            if (dimension + 1 < halton_dimensions_per_bounce
+                && halton_dimension + 1 < halton_dimension_count) {
+                first  = halton_sample_bits(stream, halton_dimension);
+                second = halton_sample_bits(stream, halton_dimension + 1);
+                return;
+            }
+            break;
+        }
+
+        case sampler_type::blue_noise: {
+            // Every pixel shares the same Sobol points, shifted (modulo 1) by a blue noise mask
+            // that is offset differently for each dimension. Neighboring pixels then get shifts
+            // that differ as much as possible, which pushes the error to high frequencies.
+            auto seed = hash64(random_seed_base().load() + 0x9e3779b97f4a7c15ull * (counter + 1));
+            uint32_t u, v;
+            sobol_pair(static_cast<uint32_t>(stream.sample_index), seed, u, v);
+
+            const auto& mask = blue_noise_mask();
+            auto offsets = hash64(seed + 2);
+            auto x = stream.pixel_x;
+            auto y = stream.pixel_y;
+            const int wrap = blue_noise_size - 1;
+            auto shift_u = mask[((y + (offsets >> 16)) & wrap) * blue_noise_size
+                                + ((x + offsets) & wrap)];
+            auto shift_v = mask[((y + (offsets >> 48)) & wrap) * blue_noise_size
+                                + ((x + (offsets >> 32)) & wrap)];
+            first  = uint64_t(u + (uint32_t(shift_u) << 20)) << 32;
+            second = uint64_t(v + (uint32_t(shift_v) << 20)) << 32;
+            return;
+        }
+
+        case sampler_type::independent:
+            break;
+    }
+
+    first  = hash64(stream.key + 0x9e3779b97f4a7c15ull * (2*counter + 1));
+    second = hash64(stream.key + 0x9e3779b97f4a7c15ull * (2*counter + 2));
+}
+
+
+inline uint64_t next_random_bits() {
+    auto& stream = thread_sample_stream();
+    if (!stream.active)
+        return thread_random_generator().next();
+
+    auto dimension = stream.dimension++;
+    uint64_t first, second;
+    sample_pair_bits(stream, dimension >> 1, first, second);
+    return (dimension & 1) ? second : first;
+}
+
+
+inline void next_random_pair(uint64_t& first, uint64_t& second) {
+    // Draws two dimensions to be used together as a 2D sample. A pair starts on an even
+    // dimension, so that both values come from the same 2D point of the sampler.
+    auto& stream = thread_sample_stream();
+    if (!stream.active) {
+        first = thread_random_generator().next();
+        second = thread_random_generator().next();
+        return;
+    }
+
+    auto pair = (stream.dimension + 1) >> 1;
+    stream.dimension = 2*pair + 2;
+    sample_pair_bits(stream, pair, first, second);
+}
+
+
+#endif
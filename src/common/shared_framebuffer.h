@@ -0,0 +1,127 @@
+#ifndef SHARED_FRAMEBUFFER_H
+#define SHARED_FRAMEBUFFER_H
+//==============================================================================================
+// To the extent possible under law, the author(s) have dedicated all copyright and related and
+// neighboring rights to this software to the public domain worldwide. This software is
+// distributed without any warranty.
+//
+// You should have received a copy (see file COPYING.txt) of the CC0 Public Domain Dedication
+// along with this software. If not, see <http://creativecommons.org/publicdomain/zero/1.0/>.
+//==============================================================================================
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define RTW_SHARED_FRAMEBUFFER 1
+#endif
+
+
+struct shared_framebuffer_header {
+    // The layout at the start of the shared memory object. The image follows the header as
+    // linear float RGB, three floats per pixel, in rows from the top of the image.
+    //
+    // The sequence number is odd while the image is being updated. A viewer copies the image
+    // when the sequence is even, and keeps the copy if the sequence has not changed since.
+    char                  magic[8];  // "RTWFBUF\0"
+    uint32_t              width;
+    uint32_t              height;
+    std::atomic<uint64_t> sequence;
+    uint64_t              samples;   // Samples taken over the whole image
+};
+
+
+class shared_framebuffer {
+    // A framebuffer in a POSIX shared memory object, such as "/rtweekend", that a local viewer
+    // can map to watch a render. Unavailable on other systems, where open() always fails.
+    public:
+        shared_framebuffer() : header(nullptr), size(0) {}
+        ~shared_framebuffer() { close(); }
+
+        shared_framebuffer(const shared_framebuffer&) = delete;
+        shared_framebuffer& operator=(const shared_framebuffer&) = delete;
+
+        // Create (or reuse) the named shared memory object, sized for the image. Returns false on
+        // failure.
+        bool open(const std::string& name, int width, int height);
+        void close();
+
+        bool is_open() const { return header != nullptr; }
+
+        // Copy a new image into shared memory. The image must have the size given to open().
+        void publish(const float* rgb, uint64_t samples);
+
+    private:
+        shared_framebuffer_header* header;
+        size_t size;
+};
+
+
+#ifdef RTW_SHARED_FRAMEBUFFER
+
+bool shared_framebuffer::open(const std::string& object_name, int width, int height) {
+    close();
+
+    auto bytes = sizeof(shared_framebuffer_header) + 3 * sizeof(float) * size_t(width) * height;
+
+    int fd = shm_open(object_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return false;
+
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+        mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if (mapping == MAP_FAILED)
+        return false;
+
+    header = static_cast<shared_framebuffer_header*>(mapping);
+    size = bytes;
+
+    std::memcpy(header->magic, "RTWFBUF", 8);
+    header->width = static_cast<uint32_t>(width);
+    header->height = static_cast<uint32_t>(height);
+    header->sequence.store(0);
+    header->samples = 0;
+    return true;
+}
+
+
+void shared_framebuffer::close() {
+    if (header)
+        munmap(header, size);
+    header = nullptr;
+    size = 0;
+}
+
+
+void shared_framebuffer::publish(const float* rgb, uint64_t samples) {
+    if (!header)
+        return;
+
+    auto sequence = header->sequence.load(std::memory_order_relaxed);
+    header->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy(reinterpret_cast<float*>(header + 1), rgb, size - sizeof(*header));
+    header->samples = samples;
+
+    header->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+#else
+
+bool shared_framebuffer::open(const std::string&, int, int) { return false; }
+void shared_framebuffer::close() {}
+void shared_framebuffer::publish(const float*, uint64_t) {}
+
+#endif
+
+
+#endif
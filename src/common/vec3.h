@@ -127,23 +127,40 @@ inline vec3 unit_vector(vec3 v) {
 }
 
 inline vec3 random_in_unit_disk() {
-    while (true) {
-        auto p = vec3(random_double(-1,1), random_double(-1,1), 0);
-        if (p.length_squared() >= 1) continue;
-        return p;
+    // Shirley and Chiu's concentric mapping from the square to the disk. Unlike rejection
+    // sampling, it uses exactly one 2D sample and keeps that sample's stratification.
+    double u, v;
+    random_double_pair(u, v);
+    auto a = 2*u - 1;
+    auto b = 2*v - 1;
+    if (a == 0 && b == 0)
+        return vec3(0, 0, 0);
+
+    double r, theta;
+    if (a*a > b*b) {
+        r = a;
+        theta = (pi/4) * (b/a);
+    } else {
+        r = b;
+        theta = (pi/2) - (pi/4) * (a/b);
     }
+    return vec3(r*cos(theta), r*sin(theta), 0);
 }
 
-inline vec3 random_in_unit_sphere() {
-    while (true) {
-        auto p = vec3::random(-1,1);
-        if (p.length_squared() >= 1) continue;
-        return p;
-    }
+inline vec3 random_unit_vector() {
+    // Uniform on the sphere: z is uniform in [-1,1] (Archimedes' hat-box theorem).
+    double u, v;
+    random_double_pair(u, v);
+    auto z = 1 - 2*u;
+    auto r = sqrt(fmax(0.0, 1 - z*z));
+    auto phi = 2*pi*v;
+    return vec3(r*cos(phi), r*sin(phi), z);
 }
 
-inline vec3 random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+inline vec3 random_in_unit_sphere() {
+    auto direction = random_unit_vector();
+    auto radius = std::cbrt(random_double());
+    return radius * direction;
 }
 
 inline vec3 random_in_hemisphere(const vec3& normal) {